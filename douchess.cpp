@@ -1,10 +1,20 @@
 #ifdef _WIN32
 #define NOMINMAX
 #include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
 #endif
 
 #include <iostream>
 #include <intrin.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 #include <cstdint>
 #include <string>
 #include <array>
@@ -20,19 +30,23 @@
 #include <atomic>
 #include <memory>
 #include <mutex>
+#include <cmath>
+#include <functional>
+#include <condition_variable>
+#include <deque>
 
 // Cross-platform time function
 long long current_time_ms() {
 #ifdef _WIN32
-    static LARGE_INTEGER frequency;
-    static BOOL first = TRUE;
-    if (first) {
-        QueryPerformanceFrequency(&frequency);
-        first = FALSE;
-    }
+    // Function-local static init is thread-safe; self-play workers call this concurrently
+    static const LONGLONG frequency = [] {
+        LARGE_INTEGER f;
+        QueryPerformanceFrequency(&f);
+        return f.QuadPart;
+    }();
     LARGE_INTEGER now;
     QueryPerformanceCounter(&now);
-    return (now.QuadPart * 1000) / frequency.QuadPart;
+    return (now.QuadPart * 1000) / frequency;
 #else
     auto now = std::chrono::steady_clock::now();
     return std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
@@ -42,21 +56,121 @@ long long current_time_ms() {
 // Constants and Enums
 typedef uint64_t U64;
 
+// Packed middlegame/endgame score: eg in the upper 16 bits, mg in the lower 16.
+// Adding, subtracting and multiplying by an int act on both halves at once.
+typedef int Score;
+
+constexpr Score S(int mg, int eg) {
+    return (Score)((unsigned int)eg << 16) + mg;
+}
+
+inline int mg_value(Score s) {
+    return (int16_t)(uint16_t)(unsigned int)s;
+}
+
+inline int eg_value(Score s) {
+    return (int16_t)(uint16_t)((unsigned int)(s + 0x8000) >> 16);
+}
+
 const int MAX_DEPTH = 64;
 const int MAX_PLY = 64;
 const int INFINITY_SCORE = 32000;
 const int MATE_SCORE = 30000;
 const int TIME_LIMIT_MS = 2000;
-const int DELTA_PRUNING_MARGIN = 200;
-const int FUTILITY_MARGIN = 300;
-const int REVERSE_FUTILITY_MARGIN = 100;
-const int HISTORY_MAX = 10000;
+const int HISTORY_MAX = 8192;            // gravity bound for every history table
 const int EVAL_CLAMP_MAX = 5000;
 const int EVAL_CLAMP_MIN = -5000;
-const int ASPIRATION_WINDOW = 25;
 const int MULTI_PV = 3;
-const int PROBCUT_MARGIN = 200;
 const int SINGULAR_MARGIN = 2;
+const int LMP_MAX_DEPTH = 8;
+const int SEE_PRUNING_DEPTH = 8;
+const int SEE_QUIET_MARGIN = 60;          // quiets: prune if SEE < -60 * depth
+const int SEE_CAPTURE_MARGIN = 20;        // captures: prune if SEE < -20 * depth^2
+const int HISTORY_PRUNING_DEPTH = 3;
+const int HISTORY_PRUNING_MARGIN = 2000;  // prune if history < -2000 * depth
+const int NULL_MOVE_EVAL_DIVISOR = 200;
+const int LMR_MAX_MOVES = 64;
+const int LMR_HISTORY_DIVISOR = 5000;     // one ply less per 5000 history points
+const int MAX_QUIETS_TRIED = 64;
+const int CORRECTION_HISTORY_SIZE = 16384;
+const int CORRECTION_GRAIN = 256;         // entries are stored in 1/256 centipawns
+const int CORRECTION_MAX = 64 * CORRECTION_GRAIN;
+const int LAZY_EVAL_MARGIN = 1000;       // bound on all non material+PST eval terms
+const int NO_EVAL = -INFINITY_SCORE - 1;  // static eval slot for in-check nodes
+
+// Search margins that can be changed at runtime: UCI setoption, the
+// DOUCHESS_PARAMS environment variable, or "douchess spsa"
+struct SearchParams {
+    int futility_margin = 300;
+    int reverse_futility_margin = 100;
+    int probcut_margin = 200;
+    int aspiration_window = 25;
+    int delta_pruning_margin = 200;
+    int razor_margin_base = 300;
+    int razor_margin_depth = 100;
+    int lmr_divisor = 200;              // LMR = log(depth) * log(moves) * 100 / divisor
+};
+
+struct TunableParam {
+    const char* name;                   // UCI option name
+    int SearchParams::* field;
+    int min;
+    int max;
+    double spsa_c;                      // SPSA perturbation at the end of a run
+};
+
+const TunableParam tunable_params[] = {
+    { "FutilityMargin", &SearchParams::futility_margin, 50, 800, 30.0 },
+    { "ReverseFutilityMargin", &SearchParams::reverse_futility_margin, 20, 400, 10.0 },
+    { "ProbcutMargin", &SearchParams::probcut_margin, 50, 600, 20.0 },
+    { "AspirationWindow", &SearchParams::aspiration_window, 5, 200, 5.0 },
+    { "DeltaPruningMargin", &SearchParams::delta_pruning_margin, 0, 600, 20.0 },
+    { "RazorMarginBase", &SearchParams::razor_margin_base, 0, 1000, 30.0 },
+    { "RazorMarginDepth", &SearchParams::razor_margin_depth, 0, 500, 10.0 },
+    { "LmrDivisor", &SearchParams::lmr_divisor, 100, 400, 15.0 },
+};
+const int TUNABLE_COUNT = (int)(sizeof(tunable_params) / sizeof(tunable_params[0]));
+
+// Each searching thread has its own parameters (self-play plays two sets)
+thread_local SearchParams search_params;
+
+// Set a tunable by name, clamped to its range; false for unknown names
+bool set_search_param(SearchParams& params, const std::string& name, int value) {
+    for (const TunableParam& tp : tunable_params) {
+        if (name == tp.name) {
+            params.*tp.field = std::max(tp.min, std::min(value, tp.max));
+            return true;
+        }
+    }
+    return false;
+}
+
+// DOUCHESS_PARAMS is either a file of "Name value" / "Name=value" lines, or
+// the same pairs inline, separated by commas
+void load_search_params_env() {
+    const char* env = std::getenv("DOUCHESS_PARAMS");
+    if (!env || !*env) return;
+    
+    std::string text = env;
+    FILE* f = fopen(env, "r");
+    if (f) {
+        text.clear();
+        char buffer[256];
+        while (fgets(buffer, sizeof(buffer), f)) text += buffer;
+        fclose(f);
+    }
+    for (char& c : text) {
+        if (c == '=' || c == ',') c = ' ';
+    }
+    std::istringstream iss(text);
+    std::string name;
+    int value;
+    while (iss >> name >> value) {
+        if (!set_search_param(search_params, name, value)) {
+            std::cerr << "DOUCHESS_PARAMS: unknown parameter " << name << std::endl;
+        }
+    }
+}
 
 int calculate_time_for_move(int time_left, int increment, int moves_to_go) {
     int base_time = time_left / std::max(moves_to_go, 20);
@@ -109,6 +223,8 @@ struct Position {
     int castling_rights;
     int en_passant_square;
     U64 hash_key;
+    U64 pawn_key;   // Zobrist key of pawns only (correction history)
+    Score psq_score;  // material + PST, White's perspective
     
     Position() {
         memset(pieces, 0, sizeof(pieces));
@@ -117,11 +233,15 @@ struct Position {
         castling_rights = 0;
         en_passant_square = -1;
         hash_key = 0;
+        pawn_key = 0;
+        psq_score = 0;
     }
 };
 
 struct BoardState {
     U64 hash_key;
+    U64 pawn_key;
+    Score psq_score;
     int castling_rights;
     int en_passant_square;
     int captured_piece;
@@ -145,18 +265,53 @@ struct TTEntry {
     Move move;
 };
 
+// Root move with statistics carried across iterative deepening iterations
+struct RootMove {
+    Move move;
+    int score = -INFINITY_SCORE;          // this iteration (-INFINITY_SCORE = not best)
+    int previous_score = -INFINITY_SCORE; // last completed iteration
+    long long nodes = 0;                  // subtree size, used to order unresolved moves
+    int sel_depth = 0;
+    std::vector<Move> pv;
+};
+
 // Global Variables
+// Everything a search writes is thread_local, so several independent searches
+// (in-process self-play games) can run at once, one per thread.
 // Search control
-bool time_up = false;
-long long start_time = 0;
-long long time_limit = 2000;
-long long nodes_searched = 0;
+thread_local bool time_up = false;
+thread_local long long start_time = 0;
+thread_local long long time_limit = 2000;
+thread_local long long node_limit = 0;      // 0 = none
+thread_local int depth_limit = MAX_DEPTH;
+thread_local bool search_silent = false;    // no info output (self-play)
+thread_local int root_score = 0;            // score of the last completed iteration
+thread_local long long nodes_searched = 0;
+thread_local int sel_depth = 0;
 
 // Game state tracking
-std::vector<U64> position_history;
-int halfmove_clock = 0;
+// Hash keys of every position since the last "position" command; the current
+// position is always on top, so key_stack[key_count - 1 - i] is i plies back.
+const int KEY_STACK_SIZE = 2048 + MAX_PLY;
+thread_local U64 key_stack[KEY_STACK_SIZE];
+thread_local int key_count = 0;
+thread_local int halfmove_clock = 0;
+
+inline void push_key(U64 key) {
+    if (key_count == KEY_STACK_SIZE) {
+        // Only the last 100-odd plies can ever repeat; keep a safe tail
+        memmove(key_stack, key_stack + KEY_STACK_SIZE - 256, 256 * sizeof(U64));
+        key_count = 256;
+    }
+    key_stack[key_count++] = key;
+}
 
-// Search control
+inline void reset_key_stack(U64 root_key) {
+    key_count = 0;
+    push_key(root_key);
+}
+
+// Search control. stop_search is set by the UCI input thread on "stop"/"quit"
 std::atomic<bool> stop_search{false};
 std::atomic<int> best_depth{0};
 std::atomic<int> best_worker_score{-INFINITY_SCORE};
@@ -165,35 +320,79 @@ struct ThreadData {
     int depth;
     long long nodes;
 };
-std::vector<ThreadData> thread_data;
+thread_local std::vector<ThreadData> thread_data;
 
-Move countermoves[6][64];
-int detect_hanging_pieces(const Position& pos, int color);
-int detect_threats(const Position& pos, int color);
-int detect_tactical_patterns(const Position& pos, int color);
-int detect_trapped_pieces(const Position& pos, int color);
+thread_local Move countermoves[6][64];
 
 // PV Table (Principal Variation Table)
-Move pv_table[MAX_PLY][MAX_PLY];
-int pv_length[MAX_PLY];
+thread_local Move pv_table[MAX_PLY][MAX_PLY];
+thread_local int pv_length[MAX_PLY];
+
+// Root moves, persistent for one search_position() call
+thread_local std::vector<RootMove> root_moves;
+
+// Search stack: move played and static eval at each ply
+thread_local Move move_stack[MAX_PLY + 1];
+thread_local int static_eval_stack[MAX_PLY + 1];
+
+// Late move pruning thresholds [improving][depth]
+int lmp_threshold[2][LMP_MAX_DEPTH + 1];
+
+// Late move reductions [depth][moves searched], for search_params.lmr_divisor
+thread_local int lmr_table[MAX_DEPTH + 1][LMR_MAX_MOVES];
+thread_local int lmr_table_divisor = 0;
 
 // Killer Moves & History
-Move killer_moves[2][MAX_DEPTH];
-int history_moves[6][64];
+thread_local Move killer_moves[2][MAX_DEPTH];
+thread_local int history_moves[2][64][64]; // [color][from][to]
 
 // Phase 3: Capture History Heuristic
-int capture_history[6][64][6]; // [piece][to][captured_piece]
+thread_local int capture_history[6][64][6]; // [piece][to][captured_piece]
 
 // Phase 3: Continuation History (2-ply)
-int continuation_history[6][64][6][64]; // [prev_piece][prev_to][piece][to]
+thread_local int continuation_history[6][64][6][64]; // [prev_piece][prev_to][piece][to]
+
+// Static eval correction history [side_to_move][pawn_key % size]
+thread_local int correction_history[2][CORRECTION_HISTORY_SIZE];
 
 // Transposition Table
 const int TT_SIZE = 1 << 24;  // 16 million entries (~512 MB) - Better for 1 sec/move
 TTEntry TTable[TT_SIZE];
 
+// The table this thread searches with: TTable for the UCI engine, a private
+// smaller one for each side of an in-process game
+thread_local TTEntry* tt_table = TTable;
+thread_local size_t tt_entries = TT_SIZE;
+
 // Attack Tables
+U64 pawn_attacks[2][64];
 U64 knight_attacks[64];
 U64 king_attacks[64];
+U64 rook_rays[64];              // empty-board rook attacks
+U64 bishop_rays[64];            // empty-board bishop attacks
+U64 between_squares[64][64];    // squares strictly between two aligned squares
+U64 line_squares[64][64];       // whole line through two aligned squares
+
+// Pawn structure masks ("forward" is toward the color's promotion rank)
+U64 file_masks[8];
+U64 rank_masks[8];              // indexed by a8=0 row (row 0 = rank 8)
+U64 adjacent_files[8];
+U64 forward_ranks[2][8];        // [color][row]: rows strictly in front
+U64 forward_file[2][64];        // squares in front on the same file
+U64 pawn_attack_span[2][64];    // squares in front on the adjacent files
+U64 passed_mask[2][64];         // forward_file | pawn_attack_span
+U64 king_shield[2][64];         // the three squares directly in front of the king
+
+// Material + PST per [color][piece][square], signed from White's perspective
+Score psq[2][6][64];
+
+inline void psq_add(Position& pos, int color, int piece, int square) {
+    pos.psq_score += psq[color][piece][square];
+}
+
+inline void psq_remove(Position& pos, int color, int piece, int square) {
+    pos.psq_score -= psq[color][piece][square];
+}
 
 // Zobrist Keys
 U64 piece_keys[2][6][64];
@@ -204,9 +403,7 @@ U64 side_key;
 // Forward Declarations
 bool is_square_attacked(const Position& pos, int square, int side);
 void unmake_move(Position& pos, const Move& move, const BoardState& state);
-int eval_mobility(const Position& pos, int color);
-int eval_king_safety(const Position& pos, int color);
-int eval_pawns(const Position& pos);
+Score eval_pawns(const Position& pos);
 void generate_pawn_moves(const Position& pos, MoveList& move_list, int color);
 void generate_knight_moves(const Position& pos, MoveList& move_list, int color);
 void generate_bishop_moves(const Position& pos, MoveList& move_list, int color);
@@ -218,6 +415,8 @@ MoveList generate_moves(const Position& pos);
 void generate_captures(const Position& pos, std::vector<Move>& captures);
 MoveList generate_legal_moves(Position& pos);
 U64 generate_hash_key(const Position& pos);
+U64 generate_pawn_key(const Position& pos);
+void refresh_psq_score(Position& pos);
 void sort_moves_enhanced(const Position& pos, std::vector<Move>& moves, const Move& tt_move, int ply = 0);
 uint64_t perft(Position& pos, int depth);
 void run_perft_tests();
@@ -329,6 +528,8 @@ void setup_starting_position(Position& pos) {
     
     // Generate hash
     pos.hash_key = generate_hash_key(pos);
+    pos.pawn_key = generate_pawn_key(pos);
+    refresh_psq_score(pos);
 }
 
 // Attack Table Initialization
@@ -366,9 +567,56 @@ void init_king_attacks() {
     }
 }
 
+void init_pawn_attacks() {
+    for (int square = 0; square < 64; square++) {
+        int file = square % 8;
+        pawn_attacks[WHITE][square] = 0ULL;
+        pawn_attacks[BLACK][square] = 0ULL;
+        // White pawns capture toward rank 8 (lower indices), black toward rank 1
+        if (file != 0 && square - 9 >= 0) set_bit(pawn_attacks[WHITE][square], square - 9);
+        if (file != 7 && square - 7 >= 0) set_bit(pawn_attacks[WHITE][square], square - 7);
+        if (file != 0 && square + 7 < 64) set_bit(pawn_attacks[BLACK][square], square + 7);
+        if (file != 7 && square + 9 < 64) set_bit(pawn_attacks[BLACK][square], square + 9);
+    }
+}
+
+void init_pawn_masks() {
+    for (int i = 0; i < 8; i++) {
+        file_masks[i] = 0x0101010101010101ULL << i;
+        rank_masks[i] = 0xFFULL << (8 * i);
+    }
+    for (int file = 0; file < 8; file++) {
+        adjacent_files[file] = (file > 0 ? file_masks[file - 1] : 0ULL) |
+                               (file < 7 ? file_masks[file + 1] : 0ULL);
+    }
+    for (int row = 0; row < 8; row++) {
+        forward_ranks[WHITE][row] = 0ULL;
+        forward_ranks[BLACK][row] = 0ULL;
+        for (int r = 0; r < row; r++) forward_ranks[WHITE][row] |= rank_masks[r];
+        for (int r = row + 1; r < 8; r++) forward_ranks[BLACK][row] |= rank_masks[r];
+    }
+    for (int color = 0; color < 2; color++) {
+        for (int sq = 0; sq < 64; sq++) {
+            int file = sq % 8, row = sq / 8;
+            forward_file[color][sq] = forward_ranks[color][row] & file_masks[file];
+            pawn_attack_span[color][sq] = forward_ranks[color][row] & adjacent_files[file];
+            passed_mask[color][sq] = forward_file[color][sq] | pawn_attack_span[color][sq];
+            
+            int shield_row = (color == WHITE) ? row - 1 : row + 1;
+            king_shield[color][sq] = (shield_row >= 0 && shield_row < 8) ?
+                rank_masks[shield_row] & (file_masks[file] | adjacent_files[file]) : 0ULL;
+        }
+    }
+}
+
+void init_line_tables();
+
 void init_attack_tables() {
+    init_pawn_attacks();
     init_knight_attacks();
     init_king_attacks();
+    init_pawn_masks();
+    init_line_tables();
 }
 
 // Helper Functions
@@ -392,6 +640,34 @@ U64 generate_hash_key(const Position& pos) {
     return key;
 }
 
+// Recompute the material + PST accumulators from scratch (position setup)
+void refresh_psq_score(Position& pos) {
+    pos.psq_score = 0;
+    for (int color = 0; color < 2; color++) {
+        for (int piece = 0; piece < 6; piece++) {
+            U64 bitboard = pos.pieces[color][piece];
+            while (bitboard) {
+                int sq = lsb_index(bitboard);
+                pop_bit(bitboard, sq);
+                psq_add(pos, color, piece, sq);
+            }
+        }
+    }
+}
+
+U64 generate_pawn_key(const Position& pos) {
+    U64 key = 0ULL;
+    for (int color = 0; color < 2; color++) {
+        U64 bitboard = pos.pieces[color][P];
+        while (bitboard) {
+            int sq = lsb_index(bitboard);
+            pop_bit(bitboard, sq);
+            key ^= piece_keys[color][P][sq];
+        }
+    }
+    return key;
+}
+
 void print_bitboard(U64 bitboard) {
     for (int rank = 0; rank < 8; rank++) {
         for (int file = 0; file < 8; file++) {
@@ -434,6 +710,27 @@ U64 get_queen_attacks(int square, U64 block) {
     return get_rook_attacks(square, block) | get_bishop_attacks(square, block);
 }
 
+void init_line_tables() {
+    for (int a = 0; a < 64; a++) {
+        rook_rays[a] = get_rook_attacks(a, 0ULL);
+        bishop_rays[a] = get_bishop_attacks(a, 0ULL);
+    }
+    for (int a = 0; a < 64; a++) {
+        for (int b = 0; b < 64; b++) {
+            between_squares[a][b] = 0ULL;
+            line_squares[a][b] = 0ULL;
+            U64 bit_a = 1ULL << a, bit_b = 1ULL << b;
+            if (rook_rays[a] & bit_b) {
+                between_squares[a][b] = get_rook_attacks(a, bit_b) & get_rook_attacks(b, bit_a);
+                line_squares[a][b] = (rook_rays[a] & rook_rays[b]) | bit_a | bit_b;
+            } else if (bishop_rays[a] & bit_b) {
+                between_squares[a][b] = get_bishop_attacks(a, bit_b) & get_bishop_attacks(b, bit_a);
+                line_squares[a][b] = (bishop_rays[a] & bishop_rays[b]) | bit_a | bit_b;
+            }
+        }
+    }
+}
+
 void generate_pawn_moves(const Position& pos, MoveList& move_list, int color) {
     if (color == WHITE) {
         U64 bitboard = pos.pieces[WHITE][P];
@@ -573,13 +870,13 @@ void generate_pawn_moves(const Position& pos, MoveList& move_list, int color) {
             }
         }
         else {
-            if (ep_sq % 8 != 0) {
+            if (ep_sq % 8 != 7) {
                 int left_pawn = ep_sq - 7;
                 if (left_pawn >= 0 && get_bit(pos.pieces[BLACK][P], left_pawn)) {
                     move_list.add_move(Move(left_pawn, ep_sq, P, 0, true, false, true, false));
                 }
             }
-            if (ep_sq % 8 != 7) {
+            if (ep_sq % 8 != 0) {
                 int right_pawn = ep_sq - 9;
                 if (right_pawn >= 0 && get_bit(pos.pieces[BLACK][P], right_pawn)) {
                     move_list.add_move(Move(right_pawn, ep_sq, P, 0, true, false, true, false));
@@ -981,11 +1278,402 @@ void generate_captures(const Position& pos, std::vector<Move>& captures) {
     }
 }
 
+// ========================================
+// NNUE Evaluation
+// ========================================
+// Network: (4 king buckets x 768 piece-square features) -> 256 x 2 -> 1.
+// Features are "HalfKA": every piece including both kings, seen from each
+// side with its own king bucket, ranks flipped for Black so both halves
+// share one set of weights. The feature transformer is int16, the output
+// layer int16 on clipped (CReLU) activations, accumulated in int32.
+//
+// File layout (little endian):
+//   uint32 magic "DNUE", uint32 version, uint32 hidden size, uint32 buckets
+//   int16  ft_weights[NNUE_INPUTS][NNUE_HIDDEN]
+//   int16  ft_bias[NNUE_HIDDEN]
+//   int16  out_weights[2][NNUE_HIDDEN]   (side to move half first)
+//   int32  out_bias
+const int NNUE_KING_BUCKETS = 4;
+const int NNUE_INPUTS = NNUE_KING_BUCKETS * 768;
+const int NNUE_HIDDEN = 256;
+const int NNUE_QA = 255;                 // activation clip / ft quantization
+const int NNUE_QB = 64;                  // output weight quantization
+const int NNUE_SCALE = 400;              // network output -> centipawns
+const uint32_t NNUE_MAGIC = 0x45554E44;  // "DNUE"
+const uint32_t NNUE_VERSION = 1;
+const size_t NNUE_HEADER_SIZE = 16;
+const size_t NNUE_FILE_SIZE = NNUE_HEADER_SIZE
+    + sizeof(int16_t) * ((size_t)NNUE_INPUTS * NNUE_HIDDEN + NNUE_HIDDEN + 2 * NNUE_HIDDEN)
+    + sizeof(int32_t);
+const int NNUE_STACK_SIZE = 1024;
+
+#if defined(__AVX2__)
+#define NNUE_AVX2
+#elif defined(__SSE4_1__) || defined(__SSE2__) || defined(_M_X64)
+#define NNUE_SSE                         // only SSE2 instructions are needed
+#endif
+
+// Read-only view of a whole file, memory mapped
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+    
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_handle == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0) { close(); return false; }
+        mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping_handle) { close(); return false; }
+        data_ptr = (const unsigned char*)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+        if (!data_ptr) { close(); return false; }
+        data_size = (size_t)file_size.QuadPart;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) { ::close(fd); return false; }
+        void* mapped = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) return false;
+        data_ptr = (const unsigned char*)mapped;
+        data_size = (size_t)st.st_size;
+#endif
+        return true;
+    }
+    
+    void close() {
+#ifdef _WIN32
+        if (data_ptr) UnmapViewOfFile(data_ptr);
+        if (mapping_handle) CloseHandle(mapping_handle);
+        if (file_handle != INVALID_HANDLE_VALUE) CloseHandle(file_handle);
+        mapping_handle = nullptr;
+        file_handle = INVALID_HANDLE_VALUE;
+#else
+        if (data_ptr) munmap((void*)data_ptr, data_size);
+#endif
+        data_ptr = nullptr;
+        data_size = 0;
+    }
+    
+    const unsigned char* data() const { return data_ptr; }
+    size_t size() const { return data_size; }
+    
+private:
+    const unsigned char* data_ptr = nullptr;
+    size_t data_size = 0;
+#ifdef _WIN32
+    HANDLE file_handle = INVALID_HANDLE_VALUE;
+    HANDLE mapping_handle = nullptr;
+#endif
+};
+
+// Weights point straight into the mapped file (or the embedded net), so
+// every SIMD load below is an unaligned one
+struct NNUENetwork {
+    const int16_t* ft_weights = nullptr;
+    const int16_t* ft_bias = nullptr;
+    const int16_t* out_weights = nullptr;
+    int32_t out_bias = 0;
+};
+
+// One entry per make_move: the accumulators after that move, plus the piece
+// changes it made so the accumulators can be brought up to date lazily
+struct DirtyPiece {
+    int color;
+    int piece;
+    int from;   // -1 when the piece appears (promotion)
+    int to;     // -1 when the piece disappears (capture)
+};
+
+struct Accumulator {
+    alignas(32) int16_t values[2][NNUE_HIDDEN];
+    bool computed[2];
+    int bucket[2];
+    DirtyPiece dirty[4];
+    int dirty_count;
+};
+
+NNUENetwork nnue_net;
+MappedFile nnue_file;
+std::vector<unsigned char> nnue_buffer;  // fallback copy when the file is misaligned
+bool nnue_enabled = false;
+std::string eval_file = "";
+thread_local Accumulator nnue_stack[NNUE_STACK_SIZE];
+thread_local int nnue_top = 0;
+
+#ifdef DOUCHESS_EMBEDDED_NET
+// Generated byte list of a network file, e.g. "0x44, 0x4E, 0x55, 0x45, ..."
+alignas(64) const unsigned char nnue_embedded_data[] = {
+#include "douchess_net.inc"
+};
+#endif
+
+// King bucket: queenside/kingside x on the two home ranks or not
+inline int nnue_bucket(int king_sq, int perspective) {
+    int sq = (perspective == WHITE) ? king_sq : (king_sq ^ 56);
+    return ((sq & 7) >= 4 ? 1 : 0) + (sq >= 48 ? 2 : 0);
+}
+
+inline int nnue_feature(int perspective, int bucket, int color, int piece, int square) {
+    int sq = (perspective == WHITE) ? square : (square ^ 56);
+    int relative_color = (color == perspective) ? 0 : 1;
+    return bucket * 768 + relative_color * 384 + piece * 64 + sq;
+}
+
+inline void nnue_add_feature(int16_t* acc, int feature) {
+    const int16_t* w = nnue_net.ft_weights + (size_t)feature * NNUE_HIDDEN;
+#if defined(NNUE_AVX2)
+    for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+        __m256i a = _mm256_load_si256((const __m256i*)(acc + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(w + i));
+        _mm256_store_si256((__m256i*)(acc + i), _mm256_add_epi16(a, b));
+    }
+#elif defined(NNUE_SSE)
+    for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+        __m128i a = _mm_load_si128((const __m128i*)(acc + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(w + i));
+        _mm_store_si128((__m128i*)(acc + i), _mm_add_epi16(a, b));
+    }
+#else
+    for (int i = 0; i < NNUE_HIDDEN; i++) acc[i] += w[i];
+#endif
+}
+
+inline void nnue_sub_feature(int16_t* acc, int feature) {
+    const int16_t* w = nnue_net.ft_weights + (size_t)feature * NNUE_HIDDEN;
+#if defined(NNUE_AVX2)
+    for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+        __m256i a = _mm256_load_si256((const __m256i*)(acc + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(w + i));
+        _mm256_store_si256((__m256i*)(acc + i), _mm256_sub_epi16(a, b));
+    }
+#elif defined(NNUE_SSE)
+    for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+        __m128i a = _mm_load_si128((const __m128i*)(acc + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(w + i));
+        _mm_store_si128((__m128i*)(acc + i), _mm_sub_epi16(a, b));
+    }
+#else
+    for (int i = 0; i < NNUE_HIDDEN; i++) acc[i] -= w[i];
+#endif
+}
+
+// sum(clamp(acc[i], 0, QA) * w[i])
+inline int32_t nnue_crelu_dot(const int16_t* acc, const int16_t* w) {
+#if defined(NNUE_AVX2)
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i qa = _mm256_set1_epi16(NNUE_QA);
+    __m256i sum = _mm256_setzero_si256();
+    for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+        __m256i a = _mm256_load_si256((const __m256i*)(acc + i));
+        a = _mm256_min_epi16(_mm256_max_epi16(a, zero), qa);
+        __m256i b = _mm256_loadu_si256((const __m256i*)(w + i));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(a, b));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+    return _mm_cvtsi128_si32(s);
+#elif defined(NNUE_SSE)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i qa = _mm_set1_epi16(NNUE_QA);
+    __m128i sum = _mm_setzero_si128();
+    for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+        __m128i a = _mm_load_si128((const __m128i*)(acc + i));
+        a = _mm_min_epi16(_mm_max_epi16(a, zero), qa);
+        __m128i b = _mm_loadu_si128((const __m128i*)(w + i));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(a, b));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+#else
+    int32_t sum = 0;
+    for (int i = 0; i < NNUE_HIDDEN; i++) {
+        int v = std::max(0, std::min((int)acc[i], NNUE_QA));
+        sum += v * w[i];
+    }
+    return sum;
+#endif
+}
+
+// Point nnue_net into a complete network image, after checking its header
+bool nnue_load_from_memory(const unsigned char* data, size_t size) {
+    if (!data || size != NNUE_FILE_SIZE) return false;
+    uint32_t header[4];
+    memcpy(header, data, sizeof(header));
+    if (header[0] != NNUE_MAGIC || header[1] != NNUE_VERSION ||
+        header[2] != (uint32_t)NNUE_HIDDEN || header[3] != (uint32_t)NNUE_KING_BUCKETS) {
+        return false;
+    }
+    
+    const unsigned char* p = data + NNUE_HEADER_SIZE;
+    nnue_net.ft_weights = (const int16_t*)p;
+    p += sizeof(int16_t) * (size_t)NNUE_INPUTS * NNUE_HIDDEN;
+    nnue_net.ft_bias = (const int16_t*)p;
+    p += sizeof(int16_t) * NNUE_HIDDEN;
+    nnue_net.out_weights = (const int16_t*)p;
+    p += sizeof(int16_t) * 2 * NNUE_HIDDEN;
+    memcpy(&nnue_net.out_bias, p, sizeof(int32_t));
+    return true;
+}
+
+void nnue_reset_stack() {
+    nnue_top = 0;
+    nnue_stack[0].computed[WHITE] = nnue_stack[0].computed[BLACK] = false;
+    nnue_stack[0].dirty_count = 0;
+}
+
+// Select the network named by the EvalFile option. An empty name (or
+// "<empty>") means the embedded net when one was compiled in, otherwise the
+// handcrafted evaluation.
+bool nnue_init(const std::string& path) {
+    nnue_enabled = false;
+    nnue_file.close();
+    nnue_buffer.clear();
+    nnue_reset_stack();
+    eval_file = path;
+    
+    if (path.empty() || path == "<empty>") {
+#ifdef DOUCHESS_EMBEDDED_NET
+        nnue_enabled = nnue_load_from_memory(nnue_embedded_data, sizeof(nnue_embedded_data));
+#endif
+        return nnue_enabled;
+    }
+    
+    if (!nnue_file.open(path)) return false;
+    const unsigned char* data = nnue_file.data();
+    
+    // int16 rows must at least be 2-byte aligned; mappings always are, but
+    // keep a private copy rather than trust that on every platform
+    if (((uintptr_t)data & 1) != 0) {
+        nnue_buffer.assign(data, data + nnue_file.size());
+        nnue_file.close();
+        data = nnue_buffer.data();
+    }
+    nnue_enabled = nnue_load_from_memory(data, nnue_buffer.empty() ? nnue_file.size() : nnue_buffer.size());
+    if (!nnue_enabled) {
+        nnue_file.close();
+        nnue_buffer.clear();
+    }
+    return nnue_enabled;
+}
+
+void nnue_refresh(const Position& pos, Accumulator& acc, int perspective) {
+    int bucket = nnue_bucket(lsb_index(pos.pieces[perspective][K]), perspective);
+    int16_t* values = acc.values[perspective];
+    memcpy(values, nnue_net.ft_bias, sizeof(int16_t) * NNUE_HIDDEN);
+    
+    for (int color = 0; color < 2; color++) {
+        for (int piece = 0; piece < 6; piece++) {
+            U64 bitboard = pos.pieces[color][piece];
+            while (bitboard) {
+                int sq = lsb_index(bitboard);
+                pop_bit(bitboard, sq);
+                nnue_add_feature(values, nnue_feature(perspective, bucket, color, piece, sq));
+            }
+        }
+    }
+    acc.bucket[perspective] = bucket;
+    acc.computed[perspective] = true;
+}
+
+// Bring the top accumulator up to date for one perspective: replay the dirty
+// pieces from the nearest computed ancestor, or refresh when the king has
+// changed bucket since then (every feature depends on the bucket)
+void nnue_update(const Position& pos, int perspective) {
+    Accumulator& top = nnue_stack[nnue_top];
+    if (top.computed[perspective]) return;
+    
+    int bucket = nnue_bucket(lsb_index(pos.pieces[perspective][K]), perspective);
+    int base = nnue_top - 1;
+    while (base >= 0 && !nnue_stack[base].computed[perspective]) base--;
+    
+    if (base < 0 || nnue_stack[base].bucket[perspective] != bucket) {
+        nnue_refresh(pos, top, perspective);
+        return;
+    }
+    
+    // The king may have left the bucket and come back since base. Replaying
+    // those plies in the top bucket still gives the right top accumulator, but
+    // they are only marked computed when the top bucket is their own.
+    int ply_bucket[NNUE_STACK_SIZE];
+    int king_sq = lsb_index(pos.pieces[perspective][K]);
+    for (int i = nnue_top; i > base; i--) {
+        ply_bucket[i] = nnue_bucket(king_sq, perspective);
+        const Accumulator& acc = nnue_stack[i];
+        for (int d = 0; d < acc.dirty_count; d++) {
+            const DirtyPiece& dp = acc.dirty[d];
+            if (dp.color == perspective && dp.piece == K && dp.from >= 0) king_sq = dp.from;
+        }
+    }
+    
+    for (int i = base + 1; i <= nnue_top; i++) {
+        Accumulator& prev = nnue_stack[i - 1];
+        Accumulator& acc = nnue_stack[i];
+        int16_t* values = acc.values[perspective];
+        memcpy(values, prev.values[perspective], sizeof(int16_t) * NNUE_HIDDEN);
+        for (int d = 0; d < acc.dirty_count; d++) {
+            const DirtyPiece& dp = acc.dirty[d];
+            if (dp.from >= 0) nnue_sub_feature(values, nnue_feature(perspective, bucket, dp.color, dp.piece, dp.from));
+            if (dp.to >= 0) nnue_add_feature(values, nnue_feature(perspective, bucket, dp.color, dp.piece, dp.to));
+        }
+        acc.bucket[perspective] = bucket;
+        acc.computed[perspective] = (ply_bucket[i] == bucket);
+    }
+}
+
+// Called by make_move before any piece is moved
+inline void nnue_push() {
+    if (!nnue_enabled) return;
+    if (nnue_top + 1 >= NNUE_STACK_SIZE) {
+        // Only reachable through very long "position ... moves" lists, which
+        // are never unmade: start over from a refresh
+        nnue_top = -1;
+    }
+    Accumulator& acc = nnue_stack[++nnue_top];
+    acc.computed[WHITE] = acc.computed[BLACK] = false;
+    acc.dirty_count = 0;
+}
+
+inline void nnue_pop() {
+    if (nnue_enabled && nnue_top > 0) nnue_top--;
+}
+
+inline void nnue_dirty(int color, int piece, int from, int to) {
+    if (!nnue_enabled) return;
+    Accumulator& acc = nnue_stack[nnue_top];
+    acc.dirty[acc.dirty_count++] = { color, piece, from, to };
+}
+
+// Network output from the side to move's perspective, in centipawns
+int nnue_evaluate(const Position& pos) {
+    nnue_update(pos, WHITE);
+    nnue_update(pos, BLACK);
+    
+    const Accumulator& acc = nnue_stack[nnue_top];
+    int stm = pos.side_to_move;
+    int32_t output = nnue_crelu_dot(acc.values[stm], nnue_net.out_weights)
+                   + nnue_crelu_dot(acc.values[1 - stm], nnue_net.out_weights + NNUE_HIDDEN)
+                   + nnue_net.out_bias;
+    int value = (int)((int64_t)output * NNUE_SCALE / (NNUE_QA * NNUE_QB));
+    return std::max(EVAL_CLAMP_MIN, std::min(value, EVAL_CLAMP_MAX));
+}
+
 // Make/Unmake Move (FIXED)
 
 BoardState make_move(Position& pos, const Move& move) {
     BoardState state;
     state.hash_key = pos.hash_key;
+    state.pawn_key = pos.pawn_key;
+    state.psq_score = pos.psq_score;
     state.castling_rights = pos.castling_rights;
     state.en_passant_square = pos.en_passant_square;
     state.captured_piece = -1;
@@ -1002,7 +1690,11 @@ BoardState make_move(Position& pos, const Move& move) {
         exit(1);
     }
     
+    nnue_push();
+    
     pos.hash_key ^= piece_keys[color][piece][from];
+    if (piece == P) pos.pawn_key ^= piece_keys[color][P][from];
+    psq_remove(pos, color, piece, from);
     
     pop_bit(pos.pieces[color][piece], from);
     pop_bit(pos.occupancies[color], from);
@@ -1013,6 +1705,9 @@ BoardState make_move(Position& pos, const Move& move) {
             if (get_bit(pos.pieces[enemy_color][p], to)) {
                 state.captured_piece = p;
                 pos.hash_key ^= piece_keys[enemy_color][p][to];
+                if (p == P) pos.pawn_key ^= piece_keys[enemy_color][P][to];
+                psq_remove(pos, enemy_color, p, to);
+                nnue_dirty(enemy_color, p, to, -1);
                 pop_bit(pos.pieces[enemy_color][p], to);
                 pop_bit(pos.occupancies[enemy_color], to);
                 pop_bit(pos.occupancies[2], to);
@@ -1036,6 +1731,9 @@ BoardState make_move(Position& pos, const Move& move) {
             if (get_bit(pos.pieces[enemy_color][p], ep_target)) {
                 state.captured_piece = p;
                 pos.hash_key ^= piece_keys[enemy_color][p][ep_target];
+                if (p == P) pos.pawn_key ^= piece_keys[enemy_color][P][ep_target];
+                psq_remove(pos, enemy_color, p, ep_target);
+                nnue_dirty(enemy_color, p, ep_target, -1);
                 pop_bit(pos.pieces[enemy_color][p], ep_target);
                 pop_bit(pos.occupancies[enemy_color], ep_target);
                 pop_bit(pos.occupancies[2], ep_target);
@@ -1053,6 +1751,9 @@ BoardState make_move(Position& pos, const Move& move) {
             set_bit(pos.occupancies[WHITE], f1);
             set_bit(pos.occupancies[2], f1);
             pos.hash_key ^= piece_keys[WHITE][R][h1] ^ piece_keys[WHITE][R][f1];
+            psq_remove(pos, WHITE, R, h1);
+            psq_add(pos, WHITE, R, f1);
+            nnue_dirty(WHITE, R, h1, f1);
         } else if (to == c1) {
             pop_bit(pos.pieces[WHITE][R], a1);
             pop_bit(pos.occupancies[WHITE], a1);
@@ -1061,6 +1762,9 @@ BoardState make_move(Position& pos, const Move& move) {
             set_bit(pos.occupancies[WHITE], d1);
             set_bit(pos.occupancies[2], d1);
             pos.hash_key ^= piece_keys[WHITE][R][a1] ^ piece_keys[WHITE][R][d1];
+            psq_remove(pos, WHITE, R, a1);
+            psq_add(pos, WHITE, R, d1);
+            nnue_dirty(WHITE, R, a1, d1);
         } else if (to == g8) {
             pop_bit(pos.pieces[BLACK][R], h8);
             pop_bit(pos.occupancies[BLACK], h8);
@@ -1069,6 +1773,9 @@ BoardState make_move(Position& pos, const Move& move) {
             set_bit(pos.occupancies[BLACK], f8);
             set_bit(pos.occupancies[2], f8);
             pos.hash_key ^= piece_keys[BLACK][R][h8] ^ piece_keys[BLACK][R][f8];
+            psq_remove(pos, BLACK, R, h8);
+            psq_add(pos, BLACK, R, f8);
+            nnue_dirty(BLACK, R, h8, f8);
         } else if (to == c8) {
             pop_bit(pos.pieces[BLACK][R], a8);
             pop_bit(pos.occupancies[BLACK], a8);
@@ -1077,6 +1784,9 @@ BoardState make_move(Position& pos, const Move& move) {
             set_bit(pos.occupancies[BLACK], d8);
             set_bit(pos.occupancies[2], d8);
             pos.hash_key ^= piece_keys[BLACK][R][a8] ^ piece_keys[BLACK][R][d8];
+            psq_remove(pos, BLACK, R, a8);
+            psq_add(pos, BLACK, R, d8);
+            nnue_dirty(BLACK, R, a8, d8);
         }
     }
     
@@ -1085,6 +1795,14 @@ BoardState make_move(Position& pos, const Move& move) {
     set_bit(pos.occupancies[2], to);
     
     pos.hash_key ^= piece_keys[color][piece][to];
+    if (piece == P && move.get_promo() == 0) pos.pawn_key ^= piece_keys[color][P][to];
+    psq_add(pos, color, move.get_promo() ? move.get_promo() : piece, to);
+    if (move.get_promo() != 0) {
+        nnue_dirty(color, piece, from, -1);
+        nnue_dirty(color, move.get_promo(), -1, to);
+    } else {
+        nnue_dirty(color, piece, from, to);
+    }
     
     if (move.get_promo() != 0) {
         pos.hash_key ^= piece_keys[color][P][to];
@@ -1136,7 +1854,7 @@ BoardState make_move(Position& pos, const Move& move) {
     pos.side_to_move = enemy_color;
     pos.hash_key ^= side_key;
     
-    position_history.push_back(pos.hash_key);
+    push_key(pos.hash_key);
     
     return state;
 }
@@ -1211,12 +1929,13 @@ void unmake_move(Position& pos, const Move& move, const BoardState& state) {
     pos.en_passant_square = state.en_passant_square;
     pos.castling_rights = state.castling_rights;
     pos.hash_key = state.hash_key;
+    pos.pawn_key = state.pawn_key;
+    pos.psq_score = state.psq_score;
     
     halfmove_clock = state.halfmove_clock;
     
-    if (!position_history.empty()) {
-        position_history.pop_back();
-    }
+    if (key_count > 0) key_count--;
+    nnue_pop();
 }
 
 // ========================================
@@ -1339,15 +2058,29 @@ static const int king_table[64] = {
 };
 
 
+// ========================================
+// Attack Info (built once per evaluation)
+// ========================================
+struct AttackInfo {
+    U64 attacks_from[64];       // attacks of the piece on each occupied square
+    U64 attacked_by[2][6];      // [color][piece type]
+    U64 attacked[2];            // every square [color] attacks
+    int king_zone_attacks[2];   // king + adjacent squares of [color] attacked by the enemy
+};
+
 // ========================================
 // FORWARD DECLARATIONS
 // ========================================
-int eval_pawns(const Position& pos);
-int eval_king_safety(const Position& pos, int color);
-int eval_mobility(const Position& pos, int color);
+Score eval_pawns(const Position& pos);
+Score eval_king_safety(const Position& pos, int color, const AttackInfo& ai);
+Score eval_mobility(const Position& pos, int color, const AttackInfo& ai);
 int eval_development(const Position& pos, int color);
 int eval_rook_on_seventh(const Position& pos, int color);
-int eval_connected_rooks(const Position& pos, int color);
+int eval_connected_rooks(const Position& pos, int color, const AttackInfo& ai);
+int detect_hanging_pieces(const Position& pos, int color, const AttackInfo& ai);
+int detect_threats(const Position& pos, int color, const AttackInfo& ai);
+int detect_tactical_patterns(const Position& pos, int color, const AttackInfo& ai);
+int detect_trapped_pieces(const Position& pos, int color, const AttackInfo& ai);
 int eval_backward_pawns(const Position& pos);
 int eval_outposts(const Position& pos, int color);
 int eval_piece_activity(const Position& pos, int color);
@@ -1396,6 +2129,146 @@ const int eg_king_table[64] = {
     -50,-30,-30,-30,-30,-30,-30,-50
 };
 
+// Passed pawn bonus by ranks advanced (default for EvalParams::passed_pawn)
+const int passed_pawn_bonus[8] = { 0, 10, 30, 50, 75, 100, 150, 200 };
+
+// ========================================
+// Evaluation Parameters
+// ========================================
+// Every tunable weight of the handcrafted evaluation, as mg/eg pairs, so that
+// "douchess tune" can treat them as one vector of Scores. Penalties are
+// stored negative. The composite terms (development, hanging pieces, ...)
+// keep their internal constants and are tuned through a single weight.
+struct EvalParams {
+    Score material[6];          // K stays 0: it cancels out
+    Score pst[6][64];           // White's view, a8 = 0; Black uses 63 - square
+    Score passed_pawn[8];       // by ranks advanced
+    Score doubled_pawn;
+    Score isolated_pawn;
+    Score mobility[6];          // per reachable square
+    Score king_off_back_rank;   // per rank, middlegame only
+    Score king_shield_pawn;
+    Score king_zone_attack;     // per attacked king-zone square
+    Score king_open_file;
+    Score castling_right;
+    Score king_in_center;       // middlegame only
+    Score bishop_pair;
+    Score development;
+    Score hanging;
+    Score threats;
+    Score tactical;
+    Score trapped;
+    Score rook_on_seventh;
+    Score connected_rooks;
+    Score outposts;
+    Score backward_pawns;
+    Score piece_activity;
+};
+
+const int EVAL_PARAM_COUNT = (int)(sizeof(EvalParams) / sizeof(Score));
+
+EvalParams eval_params;
+
+#ifdef DOUCHESS_TUNED_PARAMS
+// Written by "douchess tune": const EvalParams tuned_eval_params = { ... };
+#include "douchess_params.h"
+#endif
+
+// Field names and sizes in declaration order, for the tuner's header output
+struct EvalParamField {
+    const char* name;
+    int count;
+    int row_length;     // innermost array size (count for 1-D, 1 for scalars)
+    double step;        // tuner step relative to a centipawn parameter
+};
+
+// The composite weights are small integer multipliers, so they move slowly
+const EvalParamField eval_param_fields[] = {
+    { "material", 6, 6, 1.0 }, { "pst", 6 * 64, 64, 1.0 }, { "passed_pawn", 8, 8, 1.0 },
+    { "doubled_pawn", 1, 1, 1.0 }, { "isolated_pawn", 1, 1, 1.0 }, { "mobility", 6, 6, 1.0 },
+    { "king_off_back_rank", 1, 1, 1.0 }, { "king_shield_pawn", 1, 1, 1.0 },
+    { "king_zone_attack", 1, 1, 1.0 }, { "king_open_file", 1, 1, 1.0 },
+    { "castling_right", 1, 1, 1.0 }, { "king_in_center", 1, 1, 1.0 }, { "bishop_pair", 1, 1, 1.0 },
+    { "development", 1, 1, 0.05 }, { "hanging", 1, 1, 0.05 }, { "threats", 1, 1, 0.05 },
+    { "tactical", 1, 1, 0.05 }, { "trapped", 1, 1, 0.05 }, { "rook_on_seventh", 1, 1, 0.05 },
+    { "connected_rooks", 1, 1, 0.05 }, { "outposts", 1, 1, 0.05 }, { "backward_pawns", 1, 1, 0.05 },
+    { "piece_activity", 1, 1, 0.05 },
+};
+
+// Coefficient of every parameter in one evaluation, White minus Black, plus
+// the packed total so the tuner can recover the untuned remainder
+struct EvalTrace {
+    double coef[EVAL_PARAM_COUNT];
+    Score total;
+};
+
+thread_local EvalTrace* eval_trace = nullptr;
+
+inline void trace_param(const Score& param, double count, int color) {
+    if (eval_trace) {
+        eval_trace->coef[&param - (const Score*)&eval_params] += (color == WHITE) ? count : -count;
+    }
+}
+
+// count * param from color's perspective, recorded when tracing
+inline Score weighted(const Score& param, int count, int color) {
+    trace_param(param, count, color);
+    return count * param;
+}
+
+void init_eval_params() {
+#ifdef DOUCHESS_TUNED_PARAMS
+    eval_params = tuned_eval_params;
+#else
+    const int* mg_tables[6] = {pawn_table, knight_table, bishop_table, rook_table, queen_table, mg_king_table};
+    const int* eg_tables[6] = {eg_pawn_table, knight_table, bishop_table, rook_table, queen_table, eg_king_table};
+    
+    for (int piece = 0; piece < 6; piece++) {
+        int material = (piece == K) ? 0 : piece_values[piece];
+        eval_params.material[piece] = S(material, material);
+        for (int square = 0; square < 64; square++) {
+            eval_params.pst[piece][square] = S(mg_tables[piece][square], eg_tables[piece][square]);
+        }
+    }
+    for (int rank = 0; rank < 8; rank++) {
+        eval_params.passed_pawn[rank] = S(passed_pawn_bonus[rank], passed_pawn_bonus[rank]);
+    }
+    eval_params.doubled_pawn = S(-25, -25);
+    eval_params.isolated_pawn = S(-20, -20);
+    const int mobility_mg[6] = {0, 5, 4, 3, 2, 0};
+    for (int piece = 0; piece < 6; piece++) eval_params.mobility[piece] = S(mobility_mg[piece], 0);
+    eval_params.king_off_back_rank = S(-20, 0);
+    eval_params.king_shield_pawn = S(20, 0);
+    eval_params.king_zone_attack = S(-15, 0);
+    eval_params.king_open_file = S(-30, 0);
+    eval_params.castling_right = S(15, 0);
+    eval_params.king_in_center = S(-100, 0);
+    eval_params.bishop_pair = S(50, 70);
+    eval_params.development = S(1, 0);
+    eval_params.hanging = S(-3, 0);
+    eval_params.threats = S(-2, 0);
+    eval_params.tactical = S(1, 0);
+    eval_params.trapped = S(-2, 0);
+    eval_params.rook_on_seventh = S(1, 0);
+    eval_params.connected_rooks = S(1, 0);
+    eval_params.outposts = S(1, 0);
+    eval_params.backward_pawns = S(1, 0);
+    eval_params.piece_activity = S(1, 0);
+#endif
+}
+
+void init_psq_tables() {
+    for (int color = 0; color < 2; color++) {
+        int sign = (color == WHITE) ? 1 : -1;
+        for (int piece = 0; piece < 6; piece++) {
+            for (int square = 0; square < 64; square++) {
+                int eval_square = (color == WHITE) ? square : (63 - square);
+                psq[color][piece][square] = sign * (eval_params.material[piece] + eval_params.pst[piece][eval_square]);
+            }
+        }
+    }
+}
+
 // Calculate game phase (0-24)
 int calculate_phase(const Position& pos) {
     int phase = 0;
@@ -1416,142 +2289,303 @@ int calculate_phase(const Position& pos) {
     return phase;
 }
 
-// Tapered evaluation function
-int evaluate_position_tapered(const Position& pos) {
-    int mg_score = 0, eg_score = 0;
+void compute_attack_info(const Position& pos, AttackInfo& ai) {
+    U64 occ = pos.occupancies[2];
     
     for (int color = 0; color < 2; color++) {
-        int sign = (color == WHITE) ? 1 : -1;
-        
-        // Evaluate pawns
-        U64 pawns = pos.pieces[color][P];
-        while (pawns) {
-            int square = lsb_index(pawns);
-            pop_bit(pawns, square);
-            int eval_square = (color == WHITE) ? square : (63 - square);
-            mg_score += sign * (piece_values[P] + pawn_table[eval_square]);
-            eg_score += sign * (piece_values[P] + eg_pawn_table[eval_square]);
-        }
-        
-        // Evaluate knights
-        U64 knights = pos.pieces[color][N];
-        while (knights) {
-            int square = lsb_index(knights);
-            pop_bit(knights, square);
-            int eval_square = (color == WHITE) ? square : (63 - square);
-            mg_score += sign * (piece_values[N] + knight_table[eval_square]);
-            eg_score += sign * (piece_values[N] + knight_table[eval_square]);
-        }
-        
-        // Evaluate bishops
-        U64 bishops = pos.pieces[color][B];
-        while (bishops) {
-            int square = lsb_index(bishops);
-            pop_bit(bishops, square);
-            int eval_square = (color == WHITE) ? square : (63 - square);
-            mg_score += sign * (piece_values[B] + bishop_table[eval_square]);
-            eg_score += sign * (piece_values[B] + bishop_table[eval_square]);
-        }
-        
-        // Evaluate rooks
-        U64 rooks = pos.pieces[color][R];
-        while (rooks) {
-            int square = lsb_index(rooks);
-            pop_bit(rooks, square);
-            int eval_square = (color == WHITE) ? square : (63 - square);
-            mg_score += sign * (piece_values[R] + rook_table[eval_square]);
-            eg_score += sign * (piece_values[R] + rook_table[eval_square]);
-        }
-        
-        // Evaluate queens
-        U64 queens = pos.pieces[color][Q];
-        while (queens) {
-            int square = lsb_index(queens);
-            pop_bit(queens, square);
-            int eval_square = (color == WHITE) ? square : (63 - square);
-            mg_score += sign * (piece_values[Q] + queen_table[eval_square]);
-            eg_score += sign * (piece_values[Q] + queen_table[eval_square]);
-        }
-        
-        // Evaluate kings with tapered tables
-        U64 kings = pos.pieces[color][K];
-        while (kings) {
-            int square = lsb_index(kings);
-            pop_bit(kings, square);
-            int eval_square = (color == WHITE) ? square : (63 - square);
-            mg_score += sign * (piece_values[K] + mg_king_table[eval_square]);
-            eg_score += sign * (piece_values[K] + eg_king_table[eval_square]);
-        }
-        
-        // FIX: Only add mobility to MIDDLEGAME score (not both!)
-        mg_score += sign * eval_mobility(pos, color);  // Stronger mobility evaluation
-        
-        // FIX: Only add king safety to MIDDLEGAME score
-        mg_score += sign * eval_king_safety(pos, color);
-        
-        // ADD: Development evaluation (prevents 2...Nb4 type moves)
-        mg_score += sign * eval_development(pos, color);
-        
-        // Hanging piece detection
-        mg_score -= sign * detect_hanging_pieces(pos, color) * 3;  // ✅ INCREASED to 3
+        ai.attacked[color] = 0ULL;
         
-        // Threat detection - FIXED: Remove division for stronger evaluation
-        mg_score -= sign * detect_threats(pos, color) * 2;         // ✅ INCREASED to 2
-        
-        // Tactical pattern detection
-        mg_score += sign * detect_tactical_patterns(pos, color);   // Keep at 1
-        
-        // Trapped piece detection
-        mg_score -= sign * detect_trapped_pieces(pos, color) * 2;  // ✅ INCREASED to 2
+        for (int piece = P; piece <= K; piece++) {
+            ai.attacked_by[color][piece] = 0ULL;
+            U64 bitboard = pos.pieces[color][piece];
+            while (bitboard) {
+                int sq = lsb_index(bitboard);
+                pop_bit(bitboard, sq);
+                
+                U64 attacks;
+                switch (piece) {
+                    case P: attacks = pawn_attacks[color][sq]; break;
+                    case N: attacks = knight_attacks[sq]; break;
+                    case B: attacks = get_bishop_attacks(sq, occ); break;
+                    case R: attacks = get_rook_attacks(sq, occ); break;
+                    case Q: attacks = get_queen_attacks(sq, occ); break;
+                    default: attacks = king_attacks[sq]; break;
+                }
+                
+                ai.attacks_from[sq] = attacks;
+                ai.attacked_by[color][piece] |= attacks;
+                ai.attacked[color] |= attacks;
+            }
+        }
     }
     
-    // Add pawn structure evaluation (FIXED: Only add once per color)
-    // Note: eval_pawns() already handles both colors internally, so we only call it once
-    int pawn_score = eval_pawns(pos);
-    mg_score += pawn_score;
-    eg_score += pawn_score;
-    
-    // Add new evaluation functions (moved outside color loop)
-    // These will be added after the color loop ends
-    
-    // Add bishop pair bonus (more valuable in endgame)
-    int white_bishops = count_bits(pos.pieces[WHITE][B]);
-    int black_bishops = count_bits(pos.pieces[BLACK][B]);
-    if (white_bishops >= 2) mg_score += 50;
-    if (black_bishops >= 2) mg_score -= 50;
-    if (white_bishops >= 2) eg_score += 70;
-    if (black_bishops >= 2) eg_score -= 70;
-    
-    // Add new evaluation functions (called once for the whole position)
-    mg_score += eval_rook_on_seventh(pos, WHITE) - eval_rook_on_seventh(pos, BLACK);
-    mg_score += eval_connected_rooks(pos, WHITE) - eval_connected_rooks(pos, BLACK);
-    mg_score += eval_outposts(pos, WHITE) - eval_outposts(pos, BLACK);
-    mg_score += eval_backward_pawns(pos);
-    mg_score += eval_piece_activity(pos, WHITE) - eval_piece_activity(pos, BLACK);
-    
-    // Calculate phase and interpolate
-    int phase = calculate_phase(pos);
-    int score = (mg_score * phase + eg_score * (24 - phase)) / 24;
+    for (int color = 0; color < 2; color++) {
+        U64 king_bb = pos.pieces[color][K];
+        if (king_bb == 0) {
+            ai.king_zone_attacks[color] = 0;
+            continue;
+        }
+        int king_sq = lsb_index(king_bb);
+        ai.king_zone_attacks[color] = count_bits((king_attacks[king_sq] | king_bb) & ai.attacked[1 - color]);
+    }
+}
+
+// ========================================
+// KPK Bitbase
+// ========================================
+// Exact win/draw for every king + pawn vs king position, built once at
+// startup by retrograde iteration. Positions are normalized to White holding
+// the pawn on files a-d, so the table covers 24 pawn squares x 64 x 64 king
+// squares x 2 sides to move, one bit per position (24 KB).
+
+const int KPK_SIZE = 24 * 64 * 64 * 2;
+const int KPK_INVALID = 0, KPK_UNKNOWN = 1, KPK_DRAW = 2, KPK_WIN = 4;
+const int KPK_WIN_SCORE = 600;  // below a fresh queen, so promoting stays attractive
+
+uint32_t kpk_bitbase[KPK_SIZE / 32];  // bit set = the side with the pawn wins
+
+// Pawn on files a-d, rows 1-6 (rank 7 down to rank 2)
+inline int kpk_index(int side, int white_king, int black_king, int pawn_sq) {
+    int pawn_index = (pawn_sq % 8) * 6 + (pawn_sq / 8 - 1);
+    return side + 2 * black_king + 128 * white_king + 8192 * pawn_index;
+}
+
+// Result of one position from the results of its successors
+int kpk_classify(const std::vector<uint8_t>& db, int side, int white_king, int black_king, int pawn_sq) {
+    int result = KPK_INVALID;
+    
+    if (side == WHITE) {
+        U64 moves = king_attacks[white_king];
+        while (moves) {
+            int to = lsb_index(moves);
+            pop_bit(moves, to);
+            result |= db[kpk_index(BLACK, to, black_king, pawn_sq)];
+        }
+        
+        // Pushes to the 8th rank were scored in the initial pass
+        int push = pawn_sq - 8;
+        if (pawn_sq / 8 > 1) {
+            result |= db[kpk_index(BLACK, white_king, black_king, push)];
+            if (pawn_sq / 8 == 6 && push != white_king && push != black_king) {
+                result |= db[kpk_index(BLACK, white_king, black_king, push - 8)];
+            }
+        }
+        return (result & KPK_WIN) ? KPK_WIN : (result & KPK_UNKNOWN) ? KPK_UNKNOWN : KPK_DRAW;
+    }
+    
+    // Illegal king moves land on invalid entries and add nothing
+    U64 moves = king_attacks[black_king];
+    while (moves) {
+        int to = lsb_index(moves);
+        pop_bit(moves, to);
+        result |= db[kpk_index(WHITE, white_king, to, pawn_sq)];
+    }
+    return (result & KPK_DRAW) ? KPK_DRAW : (result & KPK_UNKNOWN) ? KPK_UNKNOWN : KPK_WIN;
+}
+
+void init_kpk_bitbase() {
+    std::vector<uint8_t> db(KPK_SIZE, KPK_INVALID);
+    
+    // Initial pass: illegal positions, safe promotions, stalemates and lost pawns
+    for (int index = 0; index < KPK_SIZE; index++) {
+        int side = index & 1;
+        int black_king = (index >> 1) & 63;
+        int white_king = (index >> 7) & 63;
+        int pawn_index = index >> 13;
+        int pawn_sq = (pawn_index % 6 + 1) * 8 + pawn_index / 6;
+        
+        if (white_king == black_king || white_king == pawn_sq || black_king == pawn_sq) continue;
+        if (king_attacks[white_king] & (1ULL << black_king)) continue;
+        if (side == WHITE && (pawn_attacks[WHITE][pawn_sq] & (1ULL << black_king))) continue;
+        
+        if (side == WHITE) {
+            int promo = pawn_sq - 8;
+            bool safe_promotion = pawn_sq / 8 == 1 && promo != white_king && promo != black_king &&
+                                  (!(king_attacks[black_king] & (1ULL << promo)) || (king_attacks[white_king] & (1ULL << promo)));
+            db[index] = safe_promotion ? KPK_WIN : KPK_UNKNOWN;
+        } else {
+            U64 covered = king_attacks[white_king] | pawn_attacks[WHITE][pawn_sq];
+            bool stalemate = !(king_attacks[black_king] & ~covered);
+            bool takes_pawn = (king_attacks[black_king] & (1ULL << pawn_sq)) && !(king_attacks[white_king] & (1ULL << pawn_sq));
+            db[index] = (stalemate || takes_pawn) ? KPK_DRAW : KPK_UNKNOWN;
+        }
+    }
+    
+    // Propagate until nothing changes; whatever is still unknown is a draw
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int index = 0; index < KPK_SIZE; index++) {
+            if (db[index] != KPK_UNKNOWN) continue;
+            int pawn_index = index >> 13;
+            int result = kpk_classify(db, index & 1, (index >> 7) & 63, (index >> 1) & 63,
+                                      (pawn_index % 6 + 1) * 8 + pawn_index / 6);
+            if (result != KPK_UNKNOWN) {
+                db[index] = (uint8_t)result;
+                changed = true;
+            }
+        }
+    }
+    
+    memset(kpk_bitbase, 0, sizeof(kpk_bitbase));
+    for (int index = 0; index < KPK_SIZE; index++) {
+        if (db[index] == KPK_WIN) kpk_bitbase[index >> 5] |= 1u << (index & 31);
+    }
+}
+
+// True when the side with the pawn wins. Squares as in Position.
+bool kpk_probe(int strong_side, int strong_king, int weak_king, int pawn_sq, int side_to_move) {
+    if (strong_side == BLACK) {
+        strong_king ^= 56;
+        weak_king ^= 56;
+        pawn_sq ^= 56;
+        side_to_move = 1 - side_to_move;
+    }
+    if (pawn_sq % 8 >= 4) {
+        strong_king ^= 7;
+        weak_king ^= 7;
+        pawn_sq ^= 7;
+    }
+    int index = kpk_index(side_to_move, strong_king, weak_king, pawn_sq);
+    return (kpk_bitbase[index >> 5] >> (index & 31)) & 1;
+}
+
+// King + pawn vs king from the side to move's perspective: 0 when drawn,
+// otherwise a win score that grows as the pawn advances
+int evaluate_kpk(const Position& pos) {
+    int strong = pos.pieces[WHITE][P] ? WHITE : BLACK;
+    int pawn_sq = lsb_index(pos.pieces[strong][P]);
+    if (!kpk_probe(strong, lsb_index(pos.pieces[strong][K]), lsb_index(pos.pieces[1 - strong][K]), pawn_sq, pos.side_to_move)) {
+        return 0;
+    }
+    int advance = (strong == WHITE) ? 7 - pawn_sq / 8 : pawn_sq / 8;
+    int value = KPK_WIN_SCORE + 20 * advance;
+    return (strong == pos.side_to_move) ? value : -value;
+}
+
+// Evaluations per path since the start of the search (see evaluate_position)
+struct EvalStats {
+    long long material;   // lopsided material: material + PST only
+    long long lazy;       // handcrafted, material + PST far outside the window
+    long long full;       // handcrafted, all terms
+    long long network;    // NNUE
+    long long bitbase;    // KPK bitbase
+};
+thread_local EvalStats eval_stats;
+
+// Above this material imbalance (centipawns) evaluate_position() skips the
+// positional terms and the network, unless one side has a bare king: mating
+// needs the king-driving terms. 0 disables. UCI option MaterialEvalThreshold.
+int material_eval_threshold = 1000;
+
+// Material + PST only, interpolated, tempo and clamp as in the full evaluation
+int evaluate_material_psq(const Position& pos) {
+    int phase = calculate_phase(pos);
+    int value = (mg_value(pos.psq_score) * phase + eg_value(pos.psq_score) * (24 - phase)) / 24;
+    value = std::max(EVAL_CLAMP_MIN, std::min(value, EVAL_CLAMP_MAX)) + 7;
+    return (pos.side_to_move == WHITE) ? value : -value;
+}
+
+// Tapered evaluation function
+// Handcrafted evaluation, except that it returns the material+PST score alone
+// when that is more than LAZY_EVAL_MARGIN outside (alpha, beta). Both bounds
+// are from the side to move's perspective, like the return value.
+int evaluate_position_lazy(const Position& pos, int alpha, int beta) {
+    // Material + PST is kept up to date by make_move/unmake_move
+    Score score = pos.psq_score;
+    
+    int phase = calculate_phase(pos);
+    
+    // Lazy exit: the remaining terms cannot bring the score back inside the window
+    if (alpha > -INFINITY_SCORE || beta < INFINITY_SCORE) {
+        int lazy_score = (mg_value(score) * phase + eg_value(score) * (24 - phase)) / 24;
+        lazy_score = std::max(EVAL_CLAMP_MIN, std::min(lazy_score, EVAL_CLAMP_MAX)) + 7;
+        if (pos.side_to_move == BLACK) lazy_score = -lazy_score;
+        if (lazy_score - LAZY_EVAL_MARGIN >= beta || lazy_score + LAZY_EVAL_MARGIN <= alpha) {
+            eval_stats.lazy++;
+            return lazy_score;
+        }
+    }
+    eval_stats.full++;
+    
+    AttackInfo ai;
+    compute_attack_info(pos, ai);
+    
+    for (int color = 0; color < 2; color++) {
+        int sign = (color == WHITE) ? 1 : -1;
+        
+        score += sign * eval_mobility(pos, color, ai);
+        score += sign * eval_king_safety(pos, color, ai);
+        
+        // ADD: Development evaluation (prevents 2...Nb4 type moves)
+        score += sign * weighted(eval_params.development, eval_development(pos, color), color);
+        
+        // Hanging pieces, threats, tactics and trapped pieces
+        score += sign * weighted(eval_params.hanging, detect_hanging_pieces(pos, color, ai), color);
+        score += sign * weighted(eval_params.threats, detect_threats(pos, color, ai), color);
+        score += sign * weighted(eval_params.tactical, detect_tactical_patterns(pos, color, ai), color);
+        score += sign * weighted(eval_params.trapped, detect_trapped_pieces(pos, color, ai), color);
+        
+        // Bishop pair (more valuable in endgame)
+        if (count_bits(pos.pieces[color][B]) >= 2) score += sign * weighted(eval_params.bishop_pair, 1, color);
+        
+        score += sign * weighted(eval_params.rook_on_seventh, eval_rook_on_seventh(pos, color), color);
+        score += sign * weighted(eval_params.connected_rooks, eval_connected_rooks(pos, color, ai), color);
+        score += sign * weighted(eval_params.outposts, eval_outposts(pos, color), color);
+        score += sign * weighted(eval_params.piece_activity, eval_piece_activity(pos, color), color);
+    }
+    
+    // Pawn structure (eval_pawns() handles both colors internally)
+    score += eval_pawns(pos);
+    score += weighted(eval_params.backward_pawns, eval_backward_pawns(pos), WHITE);
+    
+    if (eval_trace) eval_trace->total = score;
+    
+    // Interpolate: the only place the packed score is split
+    int value = (mg_value(score) * phase + eg_value(score) * (24 - phase)) / 24;
     
     // FIX: Clamp score to prevent overflow (using named constants)
-    if (score > EVAL_CLAMP_MAX) score = EVAL_CLAMP_MAX;
-    if (score < EVAL_CLAMP_MIN) score = EVAL_CLAMP_MIN;
+    if (value > EVAL_CLAMP_MAX) value = EVAL_CLAMP_MAX;
+    if (value < EVAL_CLAMP_MIN) value = EVAL_CLAMP_MIN;
     
-    // FIXED: Return score from side-to-move's perspective
-    // Negamax expects the score to be from the current player's perspective
-    // But evaluation should ALWAYS return from White's perspective
-    // The search handles the negation via -score in negamax
     // Return from side-to-move's perspective for negamax
-    // Add tempo bonus (side to move has initiative)
-    score += 7;  // Tempo bonus (having the move)
+    value += 7;  // Tempo bonus (having the move)
     
-    return (pos.side_to_move == WHITE) ? score : -score;
+    return (pos.side_to_move == WHITE) ? value : -value;
 }
 
-// ========================================
-// INSERT: Pawn Structure Evaluation (Handcrafted ELO)
-// ========================================
-const int passed_pawn_bonus[8] = { 0, 10, 30, 50, 75, 100, 150, 200 };
+// Search entry point. KPK comes from the bitbase, clearly decided positions get
+// the material + PST score, and the rest go to the network when one is loaded,
+// else the handcrafted eval.
+int evaluate_position(const Position& pos, int alpha, int beta) {
+    // King + pawn vs king is looked up exactly
+    if (count_bits(pos.occupancies[2]) == 3 && (pos.pieces[WHITE][P] | pos.pieces[BLACK][P])) {
+        eval_stats.bitbase++;
+        return evaluate_kpk(pos);
+    }
+    
+    bool bare_king = pos.occupancies[WHITE] == pos.pieces[WHITE][K] || pos.occupancies[BLACK] == pos.pieces[BLACK][K];
+    if (material_eval_threshold > 0 && !bare_king) {
+        int material = 0;
+        for (int piece = P; piece <= Q; piece++) {
+            material += piece_values[piece] * (count_bits(pos.pieces[WHITE][piece]) - count_bits(pos.pieces[BLACK][piece]));
+        }
+        if (std::abs(material) > material_eval_threshold) {
+            eval_stats.material++;
+            return evaluate_material_psq(pos);
+        }
+    }
+    
+    if (nnue_enabled) {
+        eval_stats.network++;
+        return nnue_evaluate(pos);
+    }
+    return evaluate_position_lazy(pos, alpha, beta);
+}
+
+int evaluate_position_tapered(const Position& pos) {
+    return evaluate_position(pos, -INFINITY_SCORE, INFINITY_SCORE);
+}
 
 // ========================================
 // COMPLETE PAWN STRUCTURE EVALUATION
@@ -1559,23 +2593,17 @@ const int passed_pawn_bonus[8] = { 0, 10, 30, 50, 75, 100, 150, 200 };
 
 // Add these functions BEFORE eval_pawns():
 
-int eval_doubled_pawns(const Position& pos) {
-    int score = 0;
+Score eval_doubled_pawns(const Position& pos) {
+    Score score = 0;
     
     for (int color = 0; color < 2; color++) {
-        int sign = (color == WHITE) ? -1 : 1;
+        int sign = (color == WHITE) ? 1 : -1;
         U64 pawns = pos.pieces[color][P];
         
         for (int file = 0; file < 8; file++) {
-            int pawn_count = 0;
-            for (int rank = 0; rank < 8; rank++) {
-                if (get_bit(pawns, rank * 8 + file)) {
-                    pawn_count++;
-                }
-            }
-            
+            int pawn_count = count_bits(pawns & file_masks[file]);
             if (pawn_count >= 2) {
-                score += sign * 25 * (pawn_count - 1);  // -25 per doubled pawn
+                score += sign * weighted(eval_params.doubled_pawn, pawn_count - 1, color);
             }
         }
     }
@@ -1583,45 +2611,17 @@ int eval_doubled_pawns(const Position& pos) {
     return score;
 }
 
-int eval_isolated_pawns(const Position& pos) {
-    int score = 0;
+Score eval_isolated_pawns(const Position& pos) {
+    Score score = 0;
     
     for (int color = 0; color < 2; color++) {
-        int sign = (color == WHITE) ? -1 : 1;
+        int sign = (color == WHITE) ? 1 : -1;
         U64 pawns = pos.pieces[color][P];
         
+        // One penalty per file whose pawns have no neighbours on adjacent files
         for (int file = 0; file < 8; file++) {
-            bool has_pawn = false;
-            for (int rank = 0; rank < 8; rank++) {
-                if (get_bit(pawns, rank * 8 + file)) {
-                    has_pawn = true;
-                    break;
-                }
-            }
-            
-            if (has_pawn) {
-                // Check adjacent files
-                bool has_neighbor = false;
-                if (file > 0) {
-                    for (int rank = 0; rank < 8; rank++) {
-                        if (get_bit(pawns, rank * 8 + (file - 1))) {
-                            has_neighbor = true;
-                            break;
-                        }
-                    }
-                }
-                if (file < 7 && !has_neighbor) {
-                    for (int rank = 0; rank < 8; rank++) {
-                        if (get_bit(pawns, rank * 8 + (file + 1))) {
-                            has_neighbor = true;
-                            break;
-                        }
-                    }
-                }
-                
-                if (!has_neighbor) {
-                    score += sign * 20;  // -20 per isolated pawn
-                }
+            if ((pawns & file_masks[file]) && !(pawns & adjacent_files[file])) {
+                score += sign * weighted(eval_params.isolated_pawn, 1, color);
             }
         }
     }
@@ -1656,7 +2656,7 @@ int eval_rook_on_seventh(const Position& pos, int color) {
 // ========================================
 // CONNECTED ROOKS EVALUATION
 // ========================================
-int eval_connected_rooks(const Position& pos, int color) {
+int eval_connected_rooks(const Position& pos, int color, const AttackInfo& ai) {
     U64 rooks = pos.pieces[color][R];
     if (count_bits(rooks) < 2) return 0;
     
@@ -1675,7 +2675,7 @@ int eval_connected_rooks(const Position& pos, int color) {
             // Check if rooks are on same file or rank
             if (sq1 / 8 == sq2 / 8 || sq1 % 8 == sq2 % 8) {
                 // Check if path is clear
-                U64 between = get_rook_attacks(sq1, pos.occupancies[2]) & (1ULL << sq2);
+                U64 between = ai.attacks_from[sq1] & (1ULL << sq2);
                 if (between) {
                     bonus += 30;  // Connected rooks bonus
                 }
@@ -1702,43 +2702,13 @@ int eval_backward_pawns(const Position& pos) {
             int sq = lsb_index(temp);
             pop_bit(temp, sq);
             
-            int file = sq % 8;
-            int rank = sq / 8;
+            // Backward: no friendly pawn behind on the adjacent files...
+            if (pawn_attack_span[1 - color][sq] & pawns) continue;
             
-            // Check if pawn is backward
-            bool is_backward = true;
-            
-            // Check adjacent files for friendly pawns behind this one
-            for (int f = std::max(0, file - 1); f <= std::min(7, file + 1); f++) {
-                if (f == file) continue;  // Skip same file
-                
-                for (int r = (color == WHITE ? rank + 1 : 0);
-                     r < (color == WHITE ? 8 : rank); r++) {
-                    if (get_bit(pawns, r * 8 + f)) {
-                        is_backward = false;
-                        break;
-                    }
-                }
-                if (!is_backward) break;
-            }
-            
-            // Check if square in front is attacked by enemy pawn
-            if (is_backward) {
-                int front_sq = (color == WHITE) ? sq - 8 : sq + 8;
-                if (front_sq >= 0 && front_sq < 64) {
-                    // Check if enemy pawn attacks this square
-                    if (color == WHITE) {
-                        if ((front_sq % 8 != 0 && get_bit(enemy_pawns, front_sq + 7)) ||
-                            (front_sq % 8 != 7 && get_bit(enemy_pawns, front_sq + 9))) {
-                            score += sign * 15;  // Backward pawn penalty
-                        }
-                    } else {
-                        if ((front_sq % 8 != 0 && get_bit(enemy_pawns, front_sq - 9)) ||
-                            (front_sq % 8 != 7 && get_bit(enemy_pawns, front_sq - 7))) {
-                            score += sign * 15;
-                        }
-                    }
-                }
+            // ...and the square in front is controlled by an enemy pawn
+            int front_sq = (color == WHITE) ? sq - 8 : sq + 8;
+            if (pawn_attacks[color][front_sq] & enemy_pawns) {
+                score += sign * 15;  // Backward pawn penalty
             }
         }
     }
@@ -1760,7 +2730,6 @@ int eval_outposts(const Position& pos, int color) {
         int sq = lsb_index(knights);
         pop_bit(knights, sq);
         
-        int file = sq % 8;
         int rank = sq / 8;
         
         // Outpost criteria:
@@ -1772,55 +2741,14 @@ int eval_outposts(const Position& pos, int color) {
         if (color == WHITE && rank >= 2 && rank <= 4) is_outpost_rank = true;  // Ranks 6,5,4
         if (color == BLACK && rank >= 3 && rank <= 5) is_outpost_rank = true;  // Ranks 5,4,3
         
-        if (is_outpost_rank) {
-            // Check if can be attacked by enemy pawns
-            bool can_be_attacked = false;
+        // Enemy pawns that could ever attack this square stand in front of it on the adjacent files
+        if (is_outpost_rank && !(pawn_attack_span[color][sq] & enemy_pawns)) {
+            bool defended_by_pawn = (pawn_attacks[enemy][sq] & pos.pieces[color][P]) != 0;
             
-            if (color == WHITE) {
-                // Check if enemy pawns on adjacent files can advance to attack
-                for (int f = std::max(0, file - 1); f <= std::min(7, file + 1); f++) {
-                    if (f == file) continue;
-                    for (int r = rank + 1; r < 8; r++) {
-                        if (get_bit(enemy_pawns, r * 8 + f)) {
-                            can_be_attacked = true;
-                            break;
-                        }
-                    }
-                    if (can_be_attacked) break;
-                }
+            if (defended_by_pawn) {
+                bonus += 40;  // Strong outpost bonus
             } else {
-                for (int f = std::max(0, file - 1); f <= std::min(7, file + 1); f++) {
-                    if (f == file) continue;
-                    for (int r = 0; r < rank; r++) {
-                        if (get_bit(enemy_pawns, r * 8 + f)) {
-                            can_be_attacked = true;
-                            break;
-                        }
-                    }
-                    if (can_be_attacked) break;
-                }
-            }
-            
-            if (!can_be_attacked) {
-                // Check if defended by own pawn
-                bool defended_by_pawn = false;
-                if (color == WHITE) {
-                    if ((sq % 8 != 0 && get_bit(pos.pieces[WHITE][P], sq + 9)) ||
-                        (sq % 8 != 7 && get_bit(pos.pieces[WHITE][P], sq + 7))) {
-                        defended_by_pawn = true;
-                    }
-                } else {
-                    if ((sq % 8 != 0 && get_bit(pos.pieces[BLACK][P], sq - 9)) ||
-                        (sq % 8 != 7 && get_bit(pos.pieces[BLACK][P], sq - 7))) {
-                        defended_by_pawn = true;
-                    }
-                }
-                
-                if (defended_by_pawn) {
-                    bonus += 40;  // Strong outpost bonus
-                } else {
-                    bonus += 20;  // Weak outpost bonus
-                }
+                bonus += 20;  // Weak outpost bonus
             }
         }
     }
@@ -1841,21 +2769,9 @@ int eval_piece_activity(const Position& pos, int color) {
         int sq = lsb_index(rooks);
         pop_bit(rooks, sq);
         
-        int file = sq % 8;
-        bool open_file = true;
-        bool semi_open = true;
-        
-        // Check if file has pawns
-        for (int rank = 0; rank < 8; rank++) {
-            if (get_bit(pos.pieces[color][P], rank * 8 + file)) {
-                open_file = false;
-                semi_open = false;
-                break;
-            }
-            if (get_bit(pos.pieces[enemy][P], rank * 8 + file)) {
-                open_file = false;
-            }
-        }
+        U64 file = file_masks[sq % 8];
+        bool semi_open = !(pos.pieces[color][P] & file);
+        bool open_file = semi_open && !(pos.pieces[enemy][P] & file);
         
         if (open_file) bonus += 30;      // Rook on open file
         else if (semi_open) bonus += 15; // Rook on semi-open file
@@ -1880,8 +2796,8 @@ int eval_piece_activity(const Position& pos, int color) {
 }
 
 // Replace eval_pawns() function (lines 2577-2640) with this enhanced version:
-int eval_pawns(const Position& pos) {
-    int score = 0;
+Score eval_pawns(const Position& pos) {
+    Score score = 0;
     U64 wp = pos.pieces[WHITE][P], bp = pos.pieces[BLACK][P];
     
     // Check White Passed Pawns
@@ -1890,30 +2806,25 @@ int eval_pawns(const Position& pos) {
         int sq = lsb_index(temp_wp);
         pop_bit(temp_wp, sq);
         
-        bool is_passed = true;
-        int file = sq % 8;
         int rank = sq / 8;
         
-        // Check if passed
-        for (int f = std::max(0, file - 1); f <= std::min(7, file + 1); f++) {
-            for (int r = rank - 1; r >= 0; r--) {
-                if (get_bit(bp, r * 8 + f)) {
-                    is_passed = false;
-                    break;
-                }
-            }
-            if (!is_passed) break;
-        }
+        // Passed: no black pawn in front on this or the adjacent files
+        bool is_passed = !(passed_mask[WHITE][sq] & bp);
         
         if (is_passed) {
             int rank_bonus = 7 - rank;
-            int bonus = passed_pawn_bonus[rank_bonus];
+            int mg = mg_value(eval_params.passed_pawn[rank_bonus]);
+            int eg = eg_value(eval_params.passed_pawn[rank_bonus]);
+            int bonus = 0;  // king distance, same in both phases
             
             // ✅ NEW: Check if passed pawn is blockaded
             int front_sq = sq - 8;  // Square in front
-            if (front_sq >= 0 && get_bit(pos.occupancies[BLACK], front_sq)) {
-                bonus /= 2;  // Halve bonus if blockaded
+            bool blockaded = front_sq >= 0 && get_bit(pos.occupancies[BLACK], front_sq);
+            if (blockaded) {
+                mg /= 2;  // Halve bonus if blockaded
+                eg /= 2;
             }
+            trace_param(eval_params.passed_pawn[rank_bonus], blockaded ? 0.5 : 1.0, WHITE);
             
             // ✅ NEW: King distance evaluation (endgame only)
             int phase = calculate_phase(pos);
@@ -1938,7 +2849,7 @@ int eval_pawns(const Position& pos) {
                 }
             }
             
-            score += bonus;
+            score += S(mg + bonus, eg + bonus);
         }
     }
     
@@ -1948,29 +2859,23 @@ int eval_pawns(const Position& pos) {
         int sq = lsb_index(temp_bp);
         pop_bit(temp_bp, sq);
         
-        bool is_passed = true;
-        int file = sq % 8;
         int rank = sq / 8;
-        
-        for (int f = std::max(0, file - 1); f <= std::min(7, file + 1); f++) {
-            for (int r = rank + 1; r < 8; r++) {
-                if (get_bit(wp, r * 8 + f)) {
-                    is_passed = false;
-                    break;
-                }
-            }
-            if (!is_passed) break;
-        }
+        bool is_passed = !(passed_mask[BLACK][sq] & wp);
         
         if (is_passed) {
             int rank_bonus = rank;
-            int bonus = passed_pawn_bonus[rank_bonus];
+            int mg = mg_value(eval_params.passed_pawn[rank_bonus]);
+            int eg = eg_value(eval_params.passed_pawn[rank_bonus]);
+            int bonus = 0;
             
             // Check if blockaded
             int front_sq = sq + 8;
-            if (front_sq < 64 && get_bit(pos.occupancies[WHITE], front_sq)) {
-                bonus /= 2;
+            bool blockaded = front_sq < 64 && get_bit(pos.occupancies[WHITE], front_sq);
+            if (blockaded) {
+                mg /= 2;
+                eg /= 2;
             }
+            trace_param(eval_params.passed_pawn[rank_bonus], blockaded ? 0.5 : 1.0, BLACK);
             
             // King distance (endgame)
             int phase = calculate_phase(pos);
@@ -1993,7 +2898,7 @@ int eval_pawns(const Position& pos) {
                 }
             }
             
-            score -= bonus;
+            score -= S(mg + bonus, eg + bonus);
         }
     }
     
@@ -2007,82 +2912,78 @@ int eval_pawns(const Position& pos) {
 // ========================================
 // Hanging Piece Detection
 // ========================================
-int detect_hanging_pieces(const Position& pos, int color) {
+int detect_hanging_pieces(const Position& pos, int color, const AttackInfo& ai) {
     int penalty = 0;
     int enemy = 1 - color;
     
-    // Check each piece
+    // Check each piece the enemy attacks
     for (int piece = P; piece <= Q; piece++) {  // Don't check king
-        U64 pieces = pos.pieces[color][piece];
+        U64 pieces = pos.pieces[color][piece] & ai.attacked[enemy];
         while (pieces) {
             int sq = lsb_index(pieces);
             pop_bit(pieces, sq);
             
-            // Is this piece attacked by enemy?
-            if (is_square_attacked(pos, sq, enemy)) {
-                // Count defenders
-                int defenders = 0;
-                
-                // Check if defended by pawns
-                if (color == WHITE) {
-                    if (sq % 8 != 0 && sq + 9 < 64 && get_bit(pos.pieces[WHITE][P], sq + 9)) defenders++;
-                    if (sq % 8 != 7 && sq + 7 < 64 && get_bit(pos.pieces[WHITE][P], sq + 7)) defenders++;
-                } else {
-                    if (sq % 8 != 0 && sq - 9 >= 0 && get_bit(pos.pieces[BLACK][P], sq - 9)) defenders++;
-                    if (sq % 8 != 7 && sq - 7 >= 0 && get_bit(pos.pieces[BLACK][P], sq - 7)) defenders++;
-                }
-                
-                // Check if defended by knights
-                U64 knight_defenders = knight_attacks[sq] & pos.pieces[color][N];
-                defenders += count_bits(knight_defenders);
-                
-                // Check if defended by bishops/queens
-                U64 bishop_defenders = get_bishop_attacks(sq, pos.occupancies[2]) &
-                                      (pos.pieces[color][B] | pos.pieces[color][Q]);
-                defenders += count_bits(bishop_defenders);
-                
-                // Check if defended by rooks/queens
-                U64 rook_defenders = get_rook_attacks(sq, pos.occupancies[2]) &
-                                    (pos.pieces[color][R] | pos.pieces[color][Q]);
-                defenders += count_bits(rook_defenders);
-                
-                // Check if defended by king
-                if (king_attacks[sq] & pos.pieces[color][K]) defenders++;
-                
-                // Count attackers
-                int attackers_count = 0;
-                
-                // Count enemy pieces attacking this square
-                if (color == WHITE) {
-                    // Check enemy pawns
-                    if (sq % 8 != 0 && sq - 9 >= 0 && get_bit(pos.pieces[BLACK][P], sq - 9)) attackers_count++;
-                    if (sq % 8 != 7 && sq - 7 >= 0 && get_bit(pos.pieces[BLACK][P], sq - 7)) attackers_count++;
-                } else {
-                    if (sq % 8 != 0 && sq + 7 < 64 && get_bit(pos.pieces[WHITE][P], sq + 7)) attackers_count++;
-                    if (sq % 8 != 7 && sq + 9 < 64 && get_bit(pos.pieces[WHITE][P], sq + 9)) attackers_count++;
-                }
-                
-                // Count enemy knights
-                U64 enemy_knight_attackers = knight_attacks[sq] & pos.pieces[enemy][N];
-                attackers_count += count_bits(enemy_knight_attackers);
-                
-                // Count enemy bishops/queens
-                U64 enemy_bishop_attackers = get_bishop_attacks(sq, pos.occupancies[2]) &
-                                              (pos.pieces[enemy][B] | pos.pieces[enemy][Q]);
-                attackers_count += count_bits(enemy_bishop_attackers);
-                
-                // Count enemy rooks/queens
-                U64 enemy_rook_attackers = get_rook_attacks(sq, pos.occupancies[2]) &
-                                            (pos.pieces[enemy][R] | pos.pieces[enemy][Q]);
-                attackers_count += count_bits(enemy_rook_attackers);
-                
-                // If more attackers than defenders, piece is hanging
-                if (attackers_count > defenders) {
-                    penalty += piece_values[piece];
-                } else if (attackers_count == defenders && attackers_count > 0) {
-                    // Equal attackers/defenders - use SEE
-                    penalty += piece_values[piece] / 4;
-                }
+            U64 diagonal = get_bishop_attacks(sq, pos.occupancies[2]);
+            U64 orthogonal = get_rook_attacks(sq, pos.occupancies[2]);
+            
+            // Count defenders
+            int defenders = 0;
+            
+            // Check if defended by pawns
+            if (color == WHITE) {
+                if (sq % 8 != 0 && sq + 9 < 64 && get_bit(pos.pieces[WHITE][P], sq + 9)) defenders++;
+                if (sq % 8 != 7 && sq + 7 < 64 && get_bit(pos.pieces[WHITE][P], sq + 7)) defenders++;
+            } else {
+                if (sq % 8 != 0 && sq - 9 >= 0 && get_bit(pos.pieces[BLACK][P], sq - 9)) defenders++;
+                if (sq % 8 != 7 && sq - 7 >= 0 && get_bit(pos.pieces[BLACK][P], sq - 7)) defenders++;
+            }
+            
+            // Check if defended by knights
+            U64 knight_defenders = knight_attacks[sq] & pos.pieces[color][N];
+            defenders += count_bits(knight_defenders);
+            
+            // Check if defended by bishops/queens
+            U64 bishop_defenders = diagonal & (pos.pieces[color][B] | pos.pieces[color][Q]);
+            defenders += count_bits(bishop_defenders);
+            
+            // Check if defended by rooks/queens
+            U64 rook_defenders = orthogonal & (pos.pieces[color][R] | pos.pieces[color][Q]);
+            defenders += count_bits(rook_defenders);
+            
+            // Check if defended by king
+            if (king_attacks[sq] & pos.pieces[color][K]) defenders++;
+            
+            // Count attackers
+            int attackers_count = 0;
+            
+            // Count enemy pieces attacking this square
+            if (color == WHITE) {
+                // Check enemy pawns
+                if (sq % 8 != 0 && sq - 9 >= 0 && get_bit(pos.pieces[BLACK][P], sq - 9)) attackers_count++;
+                if (sq % 8 != 7 && sq - 7 >= 0 && get_bit(pos.pieces[BLACK][P], sq - 7)) attackers_count++;
+            } else {
+                if (sq % 8 != 0 && sq + 7 < 64 && get_bit(pos.pieces[WHITE][P], sq + 7)) attackers_count++;
+                if (sq % 8 != 7 && sq + 9 < 64 && get_bit(pos.pieces[WHITE][P], sq + 9)) attackers_count++;
+            }
+            
+            // Count enemy knights
+            U64 enemy_knight_attackers = knight_attacks[sq] & pos.pieces[enemy][N];
+            attackers_count += count_bits(enemy_knight_attackers);
+            
+            // Count enemy bishops/queens
+            U64 enemy_bishop_attackers = diagonal & (pos.pieces[enemy][B] | pos.pieces[enemy][Q]);
+            attackers_count += count_bits(enemy_bishop_attackers);
+            
+            // Count enemy rooks/queens
+            U64 enemy_rook_attackers = orthogonal & (pos.pieces[enemy][R] | pos.pieces[enemy][Q]);
+            attackers_count += count_bits(enemy_rook_attackers);
+            
+            // If more attackers than defenders, piece is hanging
+            if (attackers_count > defenders) {
+                penalty += piece_values[piece];
+            } else if (attackers_count == defenders && attackers_count > 0) {
+                // Equal attackers/defenders - use SEE
+                penalty += piece_values[piece] / 4;
             }
         }
     }
@@ -2093,26 +2994,14 @@ int detect_hanging_pieces(const Position& pos, int color) {
 // ========================================
 // Threat Detection
 // ========================================
-int detect_threats(const Position& pos, int color) {
+int detect_threats(const Position& pos, int color, const AttackInfo& ai) {
     int threat_score = 0;
     int enemy = 1 - color;
     
-    // Make null move to see what opponent threatens
-    Position temp_pos = pos;
-    temp_pos.side_to_move = enemy;
-    
-    // Check what enemy can capture
+    // Every piece of ours the enemy could capture if it were their move
     for (int piece = P; piece <= Q; piece++) {
-        U64 our_pieces = temp_pos.pieces[color][piece];
-        while (our_pieces) {
-            int sq = lsb_index(our_pieces);
-            pop_bit(our_pieces, sq);
-            
-            if (is_square_attacked(temp_pos, sq, enemy)) {
-                // Enemy threatens this piece
-                threat_score += piece_values[piece] / 2;
-            }
-        }
+        int threatened = count_bits(pos.pieces[color][piece] & ai.attacked[enemy]);
+        threat_score += threatened * (piece_values[piece] / 2);
     }
     
     return threat_score;
@@ -2121,7 +3010,7 @@ int detect_threats(const Position& pos, int color) {
 // ========================================
 // Tactical Pattern Detection
 // ========================================
-int detect_tactical_patterns(const Position& pos, int color) {
+int detect_tactical_patterns(const Position& pos, int color, const AttackInfo& ai) {
     int bonus = 0;
     int enemy = 1 - color;
     
@@ -2162,7 +3051,7 @@ int detect_tactical_patterns(const Position& pos, int color) {
         int sq = lsb_index(bishops);
         pop_bit(bishops, sq);
         
-        U64 attacks = get_bishop_attacks(sq, pos.occupancies[2]);
+        U64 attacks = ai.attacks_from[sq] & bishop_rays[sq];  // diagonal part for queens
         
         // Check if bishop attacks enemy king
         if (get_bit(attacks, enemy_king_sq)) {
@@ -2189,7 +3078,7 @@ int detect_tactical_patterns(const Position& pos, int color) {
         int sq = lsb_index(rooks);
         pop_bit(rooks, sq);
         
-        U64 attacks = get_rook_attacks(sq, pos.occupancies[2]);
+        U64 attacks = ai.attacks_from[sq] & rook_rays[sq];  // orthogonal part for queens
         
         if (get_bit(attacks, enemy_king_sq)) {
             U64 between = get_rook_attacks(sq, pos.occupancies[2] ^ (1ULL << enemy_king_sq));
@@ -2213,7 +3102,7 @@ int detect_tactical_patterns(const Position& pos, int color) {
 // ========================================
 // Trapped Piece Detection
 // ========================================
-int detect_trapped_pieces(const Position& pos, int color) {
+int detect_trapped_pieces(const Position& pos, int color, const AttackInfo& ai) {
     int penalty = 0;
     
     // Check bishops
@@ -2223,7 +3112,7 @@ int detect_trapped_pieces(const Position& pos, int color) {
         pop_bit(bishops, sq);
         
         // Count escape squares
-        U64 moves = get_bishop_attacks(sq, pos.occupancies[2]) & ~pos.occupancies[color];
+        U64 moves = ai.attacks_from[sq] & ~pos.occupancies[color];
         int escape_squares = count_bits(moves);
         
         if (escape_squares <= 2) {
@@ -2237,7 +3126,7 @@ int detect_trapped_pieces(const Position& pos, int color) {
         int sq = lsb_index(knights);
         pop_bit(knights, sq);
         
-        U64 moves = knight_attacks[sq] & ~pos.occupancies[color];
+        U64 moves = ai.attacks_from[sq] & ~pos.occupancies[color];
         int escape_squares = count_bits(moves);
         
         if (escape_squares <= 1) {
@@ -2253,7 +3142,7 @@ int detect_trapped_pieces(const Position& pos, int color) {
         int sq = lsb_index(rooks);
         pop_bit(rooks, sq);
         
-        U64 moves = get_rook_attacks(sq, pos.occupancies[2]) & ~pos.occupancies[color];
+        U64 moves = ai.attacks_from[sq] & ~pos.occupancies[color];
         int escape_squares = count_bits(moves);
         
         if (escape_squares <= 3) {
@@ -2319,13 +3208,12 @@ int eval_development(const Position& pos, int color) {
 // ========================================
 // FIXED KING SAFETY EVALUATION
 // ========================================
-int eval_king_safety(const Position& pos, int color) {
+Score eval_king_safety(const Position& pos, int color, const AttackInfo& ai) {
     U64 king_bb = pos.pieces[color][K];
     if (king_bb == 0) return 0;
     
     int king_sq = lsb_index(king_bb);
-    int score = 0;
-    int enemy = 1 - color;
+    Score score = 0;
     
     // 1. PENALTY FOR KING NOT ON BACK RANK (CRITICAL!)
     int king_rank = king_sq / 8;
@@ -2334,7 +3222,7 @@ int eval_king_safety(const Position& pos, int color) {
             // Only penalize in middlegame
             int phase = calculate_phase(pos);
             if (phase > 12) {  // Middlegame only
-                score -= (7 - king_rank) * 20;  // Reduced from 50 to 20
+                score += weighted(eval_params.king_off_back_rank, 7 - king_rank, color);
             }
         }
     } else {
@@ -2342,89 +3230,40 @@ int eval_king_safety(const Position& pos, int color) {
             // Only penalize in middlegame
             int phase = calculate_phase(pos);
             if (phase > 12) {  // Middlegame only
-                score -= king_rank * 20;  // Reduced from 50 to 20
+                score += weighted(eval_params.king_off_back_rank, king_rank, color);
             }
         }
     }
     
     // 2. PENALTY FOR EXPOSED KING (no pawn shield)
     int king_file = king_sq % 8;
-    int pawn_shield_count = 0;
-    
-    // Check for pawns in front of king
-    if (color == WHITE) {
-        // Check squares in front (rank - 1)
-        if (king_rank > 0) {
-            for (int f = std::max(0, king_file - 1); f <= std::min(7, king_file + 1); f++) {
-                int check_sq = (king_rank - 1) * 8 + f;
-                if (get_bit(pos.pieces[WHITE][P], check_sq)) {
-                    pawn_shield_count++;
-                }
-            }
-        }
-    } else {
-        // Check squares in front (rank + 1)
-        if (king_rank < 7) {
-            for (int f = std::max(0, king_file - 1); f <= std::min(7, king_file + 1); f++) {
-                int check_sq = (king_rank + 1) * 8 + f;
-                if (get_bit(pos.pieces[BLACK][P], check_sq)) {
-                    pawn_shield_count++;
-                }
-            }
-        }
-    }
+    int pawn_shield_count = count_bits(king_shield[color][king_sq] & pos.pieces[color][P]);
     
-    score += pawn_shield_count * 20;  // +20 per pawn in shield
+    score += weighted(eval_params.king_shield_pawn, pawn_shield_count, color);
     
     // 3. PENALTY FOR KING UNDER ATTACK
-    int attackers = 0;
-    
-    // Count enemy pieces attacking king zone (king + adjacent squares)
-    for (int dr = -1; dr <= 1; dr++) {
-        for (int df = -1; df <= 1; df++) {
-            int check_rank = king_rank + dr;
-            int check_file = king_file + df;
-            
-            if (check_rank >= 0 && check_rank < 8 && check_file >= 0 && check_file < 8) {
-                int check_sq = check_rank * 8 + check_file;
-                if (is_square_attacked(pos, check_sq, enemy)) {
-                    attackers++;
-                }
-            }
-        }
-    }
+    // Enemy-attacked squares in the king zone (king + adjacent squares)
+    int attackers = ai.king_zone_attacks[color];
     
-    score -= attackers * 15;  // -15 per attacking square
+    score += weighted(eval_params.king_zone_attack, attackers, color);
     
     // 4. PENALTY FOR OPEN FILES NEAR KING
     for (int f = std::max(0, king_file - 1); f <= std::min(7, king_file + 1); f++) {
-        bool has_pawn = false;
-        for (int r = 0; r < 8; r++) {
-            if (get_bit(pos.pieces[color][P], r * 8 + f)) {
-                has_pawn = true;
-                break;
-            }
-        }
-        if (!has_pawn) {
-            score -= 30;  // -30 per open file near king
+        if (!(pos.pieces[color][P] & file_masks[f])) {
+            score += weighted(eval_params.king_open_file, 1, color);
         }
     }
     
     // 5. BONUS FOR CASTLING RIGHTS (if still available)
-    if (color == WHITE) {
-        if (pos.castling_rights & 1) score += 15;  // Kingside
-        if (pos.castling_rights & 2) score += 15;  // Queenside
-    } else {
-        if (pos.castling_rights & 4) score += 15;  // Kingside
-        if (pos.castling_rights & 8) score += 15;  // Queenside
-    }
+    int own_rights = (color == WHITE) ? (pos.castling_rights & 3) : (pos.castling_rights >> 2);
+    score += weighted(eval_params.castling_right, count_bits(own_rights), color);
     
     // 6. MASSIVE PENALTY FOR KING IN CENTER (middlegame)
     int phase = calculate_phase(pos);
     if (phase > 12) {  // Middlegame
         int center_dist = std::min({king_file, 7 - king_file, king_rank, 7 - king_rank});
         if (center_dist >= 2) {  // King in center 4x4
-            score -= 100;  // HUGE penalty for exposed king
+            score += weighted(eval_params.king_in_center, 1, color);
         }
     }
     
@@ -2434,42 +3273,16 @@ int eval_king_safety(const Position& pos, int color) {
 // ========================================
 // INSERT: Mobility Evaluation
 // ========================================
-int eval_mobility(const Position& pos, int color) {
-    int score = 0;
-    U64 occ = pos.occupancies[2];
-    
-    // Phase 2: Improved mobility weights
-    // Knight mobility - increased from 4 to 5
-    U64 knights = pos.pieces[color][N];
-    while (knights) {
-        int sq = lsb_index(knights);
-        knights ^= (1ULL << sq); // Use XOR instead of pop_bit to avoid modifying original
-        if (sq < 0 || sq >= 64) continue; // Bounds check
-        score += count_bits(knight_attacks[sq] & ~pos.occupancies[color]) * 5;
-    }
-    
-    // Bishop mobility - increased from 3 to 4
-    U64 bishops = pos.pieces[color][B];
-    while (bishops) {
-        int sq = lsb_index(bishops);
-        bishops ^= (1ULL << sq); // Use XOR instead of pop_bit to avoid modifying original
-        score += count_bits(get_bishop_attacks(sq, occ) & ~pos.occupancies[color]) * 4;
-    }
-    
-    // Rook mobility - increased from 2 to 3
-    U64 rooks = pos.pieces[color][R];
-    while (rooks) {
-        int sq = lsb_index(rooks);
-        rooks ^= (1ULL << sq); // Use XOR instead of pop_bit to avoid modifying original
-        score += count_bits(get_rook_attacks(sq, occ) & ~pos.occupancies[color]) * 3;
-    }
+Score eval_mobility(const Position& pos, int color, const AttackInfo& ai) {
+    Score score = 0;
     
-    // Queen mobility - increased from 1 to 2
-    U64 queens = pos.pieces[color][Q];
-    while (queens) {
-        int sq = lsb_index(queens);
-        queens ^= (1ULL << sq); // Use XOR instead of pop_bit to avoid modifying original
-        score += count_bits(get_queen_attacks(sq, occ) & ~pos.occupancies[color]) * 2;
+    for (int piece = N; piece <= Q; piece++) {
+        U64 pieces = pos.pieces[color][piece];
+        while (pieces) {
+            int sq = lsb_index(pieces);
+            pop_bit(pieces, sq);
+            score += weighted(eval_params.mobility[piece], count_bits(ai.attacks_from[sq] & ~pos.occupancies[color]), color);
+        }
     }
     
     return score;
@@ -2480,7 +3293,7 @@ int eval_mobility(const Position& pos, int color) {
 // ========================================
 
 void clear_tt() {
-    for (int i = 0; i < TT_SIZE; i++) TTable[i] = TTEntry();
+    for (size_t i = 0; i < tt_entries; i++) tt_table[i] = TTEntry();
 }
 
 // Clear history heuristic and killer moves
@@ -2489,35 +3302,95 @@ void clear_history() {
     memset(history_moves, 0, sizeof(history_moves));
     memset(countermoves, 0, sizeof(countermoves));  // ✅ ADD THIS
     memset(continuation_history, 0, sizeof(continuation_history));
+    memset(capture_history, 0, sizeof(capture_history));
+    memset(correction_history, 0, sizeof(correction_history));
 }
 
-// Add decay to continuation history periodically
-void decay_continuation_history() {
-    for (int i = 0; i < 6; i++)
-        for (int j = 0; j < 64; j++)
-            for (int k = 0; k < 6; k++)
-                for (int l = 0; l < 64; l++)
-                    continuation_history[i][j][k][l] /= 2;
+// Base late move reduction, adjusted per move in pvs_search. Rebuilt by
+// search_position() whenever this thread's LmrDivisor changes.
+void init_lmr_table() {
+    for (int depth = 0; depth <= MAX_DEPTH; depth++) {
+        for (int moves = 0; moves < LMR_MAX_MOVES; moves++) {
+            lmr_table[depth][moves] = (depth == 0 || moves == 0) ? 0 :
+                static_cast<int>(std::log(depth) * std::log(moves) * 100.0 / search_params.lmr_divisor);
+        }
+    }
+    lmr_table_divisor = search_params.lmr_divisor;
 }
 
-// Write to TT with ply parameter for mate score adjustment (FIXED)
-void record_tt(U64 hash, int score, int flag, int depth, Move move, int ply) {
-    int index = hash % TT_SIZE;
-    
-    // Phase 5: Two-tier TT replacement scheme
-    TTEntry& entry = TTable[index];
-    
-    // Always replace if:
-    // 1. Empty slot
-    // 2. Same position
-    // 3. Much deeper search
-    // 4. Different type (prefer EXACT over bounds)
-    bool should_replace = false;
+// Search tables that depend only on constants
+void init_search_tables() {
+    // Late move pruning: allow fewer quiets when the static eval is not improving
+    for (int improving = 0; improving <= 1; improving++) {
+        for (int depth = 0; depth <= LMP_MAX_DEPTH; depth++) {
+            lmp_threshold[improving][depth] = (3 + depth * depth) / (2 - improving);
+        }
+    }
     
-    if (entry.key == 0) {
-        should_replace = true; // Empty slot
-    } else if (entry.key == hash) {
-        should_replace = true; // Same position
+    init_lmr_table();
+}
+
+
+// Age all history tables between searches (called at every "go")
+void age_history() {
+    for (auto& color : history_moves)
+        for (auto& from : color)
+            for (int& entry : from) entry /= 2;
+    for (auto& piece : capture_history)
+        for (auto& to : piece)
+            for (int& entry : to) entry /= 2;
+    for (auto& prev_piece : continuation_history)
+        for (auto& prev_to : prev_piece)
+            for (auto& piece : prev_to)
+                for (int& entry : piece) entry /= 2;
+}
+
+// Gravity update: the entry moves toward +/-HISTORY_MAX and saturates smoothly
+inline void update_history(int& entry, int bonus) {
+    bonus = std::max(-HISTORY_MAX, std::min(bonus, HISTORY_MAX));
+    entry += bonus - entry * std::abs(bonus) / HISTORY_MAX;
+}
+
+inline int history_bonus(int depth) {
+    return std::min(32 * depth * depth, 1536);
+}
+
+// Static eval adjusted by the average search-vs-eval error seen for this pawn structure
+inline int eval_correction(const Position& pos) {
+    return correction_history[pos.side_to_move][pos.pawn_key % CORRECTION_HISTORY_SIZE] / CORRECTION_GRAIN;
+}
+
+int corrected_eval(const Position& pos, int raw_eval) {
+    int correction = eval_correction(pos);
+    return std::max(-MATE_SCORE + MAX_PLY, std::min(raw_eval + correction, MATE_SCORE - MAX_PLY));
+}
+
+// Move the entry toward (search score - raw eval); deeper results weigh more
+void update_correction_history(const Position& pos, int depth, int diff) {
+    int& entry = correction_history[pos.side_to_move][pos.pawn_key % CORRECTION_HISTORY_SIZE];
+    int weight = std::min(depth + 1, 16);
+    entry = (entry * (256 - weight) + diff * CORRECTION_GRAIN * weight) / 256;
+    entry = std::max(-CORRECTION_MAX, std::min(entry, CORRECTION_MAX));
+}
+
+// Write to TT with ply parameter for mate score adjustment (FIXED)
+void record_tt(U64 hash, int score, int flag, int depth, Move move, int ply) {
+    size_t index = hash % tt_entries;
+    
+    // Phase 5: Two-tier TT replacement scheme
+    TTEntry& entry = tt_table[index];
+    
+    // Always replace if:
+    // 1. Empty slot
+    // 2. Same position
+    // 3. Much deeper search
+    // 4. Different type (prefer EXACT over bounds)
+    bool should_replace = false;
+    
+    if (entry.key == 0) {
+        should_replace = true; // Empty slot
+    } else if (entry.key == hash) {
+        should_replace = depth + 3 >= entry.depth; // Same position, unless a qsearch result would bury a real search
     } else if (entry.depth + 4 < depth) {
         should_replace = true; // Much deeper search
     } else if (entry.flag != TT_EXACT && flag == TT_EXACT) {
@@ -2538,22 +3411,25 @@ void record_tt(U64 hash, int score, int flag, int depth, Move move, int ply) {
         stored_score = score - ply;  // FIX: SUBTRACT ply when storing
     }
     
-    TTable[index].key = hash;
-    TTable[index].score = stored_score;
-    TTable[index].flag = flag;
-    TTable[index].depth = depth;
-    TTable[index].move = move;
+    // Keep the old best move when this result has none (fail-low / stand-pat nodes)
+    if (move.move == 0 && entry.key == hash) move = entry.move;
+    
+    entry.key = hash;
+    entry.score = stored_score;
+    entry.flag = flag;
+    entry.depth = depth;
+    entry.move = move;
 }
 
 // Read from TT with ply parameter for mate score adjustment (FIXED)
 bool probe_tt(U64 hash, int depth, int alpha, int beta, int& score, Move& best_move, int ply) {
     // Phase 7: Prefetch TT entries
     #ifdef __GNUC__
-    __builtin_prefetch(&TTable[hash % TT_SIZE]);
+    __builtin_prefetch(&tt_table[hash % tt_entries]);
     #endif
     
-    int index = hash % TT_SIZE;
-    TTEntry& entry = TTable[index];
+    size_t index = hash % tt_entries;
+    TTEntry& entry = tt_table[index];
     
     if (entry.key != hash) return false;
     
@@ -2652,19 +3528,84 @@ bool is_square_attacked(const Position& pos, int square, int side) {
     return false;
 }
 
-// Check for 3-fold repetition (FIXED: Correct counting)
-bool is_repetition(const Position& pos) {
-    int repetitions = 0;
-    U64 current_hash = pos.hash_key;
+// Repetition on the key stack. Only same-side positions 4, 6, 8... plies back
+// can match. A single repeat inside the search tree is scored as a draw;
+// positions from before the root must have occurred twice (3-fold).
+bool is_repetition(const Position& pos, int ply) {
+    int end = std::min(halfmove_clock, key_count - 1);
+    int count = 0;
+    
+    for (int i = 4; i <= end; i += 2) {
+        if (key_stack[key_count - 1 - i] == pos.hash_key) {
+            if (i < ply) return true;
+            if (++count >= 2) return true;
+        }
+    }
     
-    // Only check positions since last irreversible move (pawn move/capture)
-    // This is limited by halfmove_clock
-    int start_idx = std::max(0, (int)position_history.size() - halfmove_clock);
+    return false;
+}
+
+// ========================================
+// Cuckoo Tables (upcoming repetition, Marcel van Kervinck)
+// ========================================
+// Every reversible non-pawn move (piece, from, to) is stored under the XOR of
+// the two positions' hash keys, so one lookup tells whether a single move
+// could take the current position back to one already on the key stack.
+const int CUCKOO_SIZE = 8192;
+U64 cuckoo_keys[CUCKOO_SIZE];
+int cuckoo_from[CUCKOO_SIZE];
+int cuckoo_to[CUCKOO_SIZE];
+
+inline int cuckoo_h1(U64 key) { return (int)(key & 0x1fff); }
+inline int cuckoo_h2(U64 key) { return (int)((key >> 16) & 0x1fff); }
+
+void init_cuckoo_tables() {
+    memset(cuckoo_keys, 0, sizeof(cuckoo_keys));
+    memset(cuckoo_from, 0, sizeof(cuckoo_from));
+    memset(cuckoo_to, 0, sizeof(cuckoo_to));
     
-    for (int i = start_idx; i < (int)position_history.size(); i++) {
-        if (position_history[i] == current_hash) {
-            repetitions++;
-            if (repetitions >= 2) return true;
+    for (int color = 0; color < 2; color++) {
+        for (int piece = N; piece <= K; piece++) {
+            for (int s1 = 0; s1 < 64; s1++) {
+                U64 attacks = (piece == N) ? knight_attacks[s1] :
+                              (piece == B) ? bishop_rays[s1] :
+                              (piece == R) ? rook_rays[s1] :
+                              (piece == Q) ? (bishop_rays[s1] | rook_rays[s1]) : king_attacks[s1];
+                for (int s2 = s1 + 1; s2 < 64; s2++) {
+                    if (!get_bit(attacks, s2)) continue;
+                    
+                    U64 key = piece_keys[color][piece][s1] ^ piece_keys[color][piece][s2] ^ side_key;
+                    int from = s1, to = s2;
+                    int i = cuckoo_h1(key);
+                    // Displace entries between their two slots until one lands empty
+                    while (true) {
+                        std::swap(cuckoo_keys[i], key);
+                        std::swap(cuckoo_from[i], from);
+                        std::swap(cuckoo_to[i], to);
+                        if (key == 0) break;
+                        i = (i == cuckoo_h1(key)) ? cuckoo_h2(key) : cuckoo_h1(key);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// True if the side to move has a reversible move that reaches a position
+// already seen inside the search tree, i.e. it can force a repetition.
+bool has_upcoming_repetition(const Position& pos, int ply) {
+    int end = std::min(halfmove_clock, key_count - 1);
+    if (end < 3) return false;
+    
+    for (int i = 3; i <= end && i < ply; i += 2) {
+        U64 move_key = pos.hash_key ^ key_stack[key_count - 1 - i];
+        int j = cuckoo_h1(move_key);
+        if (cuckoo_keys[j] != move_key) {
+            j = cuckoo_h2(move_key);
+            if (cuckoo_keys[j] != move_key) continue;
+        }
+        if (!(between_squares[cuckoo_from[j]][cuckoo_to[j]] & pos.occupancies[2])) {
+            return true;
         }
     }
     
@@ -2855,36 +3796,213 @@ int see_capture(const Position& pos, const Move& move) {
     return exchange_value;
 }
 
-int score_move_enhanced(const Position& pos, const Move& move, const Move& tt_move, int ply = 0) {
-    if (move.move == tt_move.move) return 100000; // TT move highest priority
+// All pieces (both colors) attacking a square under the given occupancy
+U64 attackers_to(const Position& pos, int square, U64 occ) {
+    U64 bishops_queens = pos.pieces[WHITE][B] | pos.pieces[BLACK][B] | pos.pieces[WHITE][Q] | pos.pieces[BLACK][Q];
+    U64 rooks_queens = pos.pieces[WHITE][R] | pos.pieces[BLACK][R] | pos.pieces[WHITE][Q] | pos.pieces[BLACK][Q];
+    return (pawn_attacks[BLACK][square] & pos.pieces[WHITE][P]) |
+           (pawn_attacks[WHITE][square] & pos.pieces[BLACK][P]) |
+           (knight_attacks[square] & (pos.pieces[WHITE][N] | pos.pieces[BLACK][N])) |
+           (king_attacks[square] & (pos.pieces[WHITE][K] | pos.pieces[BLACK][K])) |
+           (get_bishop_attacks(square, occ) & bishops_queens) |
+           (get_rook_attacks(square, occ) & rooks_queens);
+}
+
+// Threshold SEE (swap algorithm): true if the move wins at least `threshold`.
+// Works for quiet moves too, which see_capture() cannot score.
+bool see_ge(const Position& pos, const Move& move, int threshold) {
+    if (move.is_castling()) return threshold <= 0;
+
+    int from = move.get_from();
+    int to = move.get_to();
+    int us = pos.side_to_move;
+
+    int victim_value = 0;
+    if (move.is_enpassant()) {
+        victim_value = piece_values[P];
+    } else if (move.is_capture()) {
+        for (int p = P; p <= K; p++) {
+            if (get_bit(pos.pieces[1 - us][p], to)) {
+                victim_value = piece_values[p];
+                break;
+            }
+        }
+    }
+
+    int swap = victim_value - threshold;
+    if (swap < 0) return false;
+
+    swap = piece_values[move.get_piece()] - swap;
+    if (swap <= 0) return true;
+
+    U64 occ = pos.occupancies[2] ^ (1ULL << from) ^ (1ULL << to);
+    if (move.is_enpassant()) occ ^= 1ULL << (to + (us == WHITE ? 8 : -8));
+
+    U64 bishops_queens = pos.pieces[WHITE][B] | pos.pieces[BLACK][B] | pos.pieces[WHITE][Q] | pos.pieces[BLACK][Q];
+    U64 rooks_queens = pos.pieces[WHITE][R] | pos.pieces[BLACK][R] | pos.pieces[WHITE][Q] | pos.pieces[BLACK][Q];
+    U64 attackers = attackers_to(pos, to, occ) & occ;
+    int stm = us;
+    int result = 1;
+
+    while (true) {
+        stm = 1 - stm;
+        attackers &= occ;
+        U64 stm_attackers = attackers & pos.occupancies[stm];
+        if (!stm_attackers) break;
+        result ^= 1;
+
+        // Least valuable attacker recaptures; sliders behind it are revealed
+        int piece = P;
+        U64 bb = 0;
+        for (; piece <= K; piece++) {
+            bb = stm_attackers & pos.pieces[stm][piece];
+            if (bb) break;
+        }
+
+        if (piece == K) {
+            // King can only recapture if the other side has nothing left
+            return (attackers & ~pos.occupancies[stm]) ? (result ^ 1) : result;
+        }
+
+        swap = piece_values[piece] - swap;
+        if (swap < result) break;
+
+        occ ^= bb & (~bb + 1);  // clear least significant bit
+        if (piece == P || piece == B || piece == Q) attackers |= get_bishop_attacks(to, occ) & bishops_queens;
+        if (piece == R || piece == Q) attackers |= get_rook_attacks(to, occ) & rooks_queens;
+    }
+
+    return result != 0;
+}
+
+// Own pieces that are the only blocker between our king and an enemy slider
+U64 pinned_pieces(const Position& pos, int color, int king_sq) {
+    int enemy = 1 - color;
+    U64 snipers = (rook_rays[king_sq] & (pos.pieces[enemy][R] | pos.pieces[enemy][Q])) |
+                  (bishop_rays[king_sq] & (pos.pieces[enemy][B] | pos.pieces[enemy][Q]));
+    U64 pinned = 0ULL;
+    while (snipers) {
+        int sq = lsb_index(snipers);
+        pop_bit(snipers, sq);
+        U64 blockers = between_squares[king_sq][sq] & pos.occupancies[2];
+        if (blockers && !(blockers & (blockers - 1))) pinned |= blockers & pos.occupancies[color];
+    }
+    return pinned;
+}
+
+// Legality of a pseudo-legal move when the side to move is NOT in check.
+// Only en passant (which can uncover a rank pin) falls back to make/unmake.
+bool is_legal_fast(Position& pos, const Move& move, int king_sq, U64 pinned) {
+    int us = pos.side_to_move;
+    int from = move.get_from();
+    int to = move.get_to();
     
-    // Countermove bonus
-    if (ply > 0) {
-        // Get previous move from PV table
-        Move prev_move = pv_table[ply - 1][0];
-        if (prev_move.move != 0) {
-            int prev_piece = prev_move.get_piece();
-            int prev_to = prev_move.get_to();
-            if (countermoves[prev_piece][prev_to].move == move.move) {
-                return 18000;  // Just below killer moves
+    if (move.get_piece() == K) {
+        U64 occ = pos.occupancies[2] ^ (1ULL << from);
+        return (attackers_to(pos, to, occ) & pos.occupancies[1 - us]) == 0;
+    }
+    
+    if (move.is_enpassant()) {
+        BoardState state = make_move(pos, move);
+        bool legal = !is_square_attacked(pos, king_sq, 1 - us);
+        unmake_move(pos, move, state);
+        return legal;
+    }
+    
+    return !(pinned & (1ULL << from)) || (line_squares[king_sq][from] & (1ULL << to));
+}
+
+// True if the move attacks the enemy king (direct, discovered or via the castling rook)
+bool gives_check(const Position& pos, const Move& move) {
+    int us = pos.side_to_move;
+    U64 king_bb = pos.pieces[1 - us][K];
+    if (king_bb == 0) return false;
+    int king_sq = lsb_index(king_bb);
+    
+    int from = move.get_from();
+    int to = move.get_to();
+    int piece = move.get_promo() ? move.get_promo() : move.get_piece();
+    U64 occ = (pos.occupancies[2] ^ (1ULL << from)) | (1ULL << to);
+    if (move.is_enpassant()) occ ^= 1ULL << (to + (us == WHITE ? 8 : -8));
+    
+    switch (piece) {
+        case P: if (pawn_attacks[us][to] & king_bb) return true; break;
+        case N: if (knight_attacks[to] & king_bb) return true; break;
+        case B: if (get_bishop_attacks(to, occ) & king_bb) return true; break;
+        case R: if (get_rook_attacks(to, occ) & king_bb) return true; break;
+        case Q: if (get_queen_attacks(to, occ) & king_bb) return true; break;
+    }
+    
+    if (move.is_castling()) {
+        int rook_from = (to == g1) ? h1 : (to == c1) ? a1 : (to == g8) ? h8 : a8;
+        int rook_to = (to == g1) ? f1 : (to == c1) ? d1 : (to == g8) ? f8 : d8;
+        occ = (occ ^ (1ULL << rook_from)) | (1ULL << rook_to);
+        return (get_rook_attacks(rook_to, occ) & king_bb) != 0;
+    }
+    
+    // Discovered check by a slider the moving piece was blocking
+    U64 bishops_queens = (pos.pieces[us][B] | pos.pieces[us][Q]) & ~(1ULL << from);
+    U64 rooks_queens = (pos.pieces[us][R] | pos.pieces[us][Q]) & ~(1ULL << from);
+    return (get_bishop_attacks(king_sq, occ) & bishops_queens) ||
+           (get_rook_attacks(king_sq, occ) & rooks_queens);
+}
+
+// Quiet move score: butterfly history plus continuation history of the previous move
+int quiet_history_score(const Position& pos, const Move& move, const Move& prev_move) {
+    int score = history_moves[pos.side_to_move][move.get_from()][move.get_to()];
+    if (prev_move.move != 0) {
+        score += continuation_history[prev_move.get_piece()][prev_move.get_to()][move.get_piece()][move.get_to()];
+    }
+    return score;
+}
+
+// Beta cutoff bookkeeping: reward the cutoff move, penalize the quiets searched before it
+void update_cutoff_history(const Position& pos, const Move& best, int depth, int ply, const Move& prev_move,
+                           const Move* quiets_tried, int quiet_count) {
+    int bonus = history_bonus(depth);
+    int piece = best.get_piece();
+    int to = best.get_to();
+    
+    if (best.is_capture()) {
+        int victim = P;
+        int enemy = 1 - pos.side_to_move;
+        for (int p = 0; p < 6; p++) {
+            if (get_bit(pos.pieces[enemy][p], to)) {
+                victim = p;
+                break;
             }
         }
+        update_history(capture_history[piece][to][victim], bonus);
+        return;
     }
     
-    // Continuation History bonus
-    if (ply > 0) {
-        Move prev_move = pv_table[ply - 1][0];
+    if (ply < MAX_DEPTH && killer_moves[0][ply].move != best.move) {
+        killer_moves[1][ply] = killer_moves[0][ply];
+        killer_moves[0][ply] = best;
+    }
+    
+    if (prev_move.move != 0) {
+        countermoves[prev_move.get_piece()][prev_move.get_to()] = best;
+    }
+    
+    int color = pos.side_to_move;
+    update_history(history_moves[color][best.get_from()][to], bonus);
+    if (prev_move.move != 0) {
+        update_history(continuation_history[prev_move.get_piece()][prev_move.get_to()][piece][to], bonus);
+    }
+    
+    for (int i = 0; i < quiet_count; i++) {
+        const Move& quiet = quiets_tried[i];
+        update_history(history_moves[color][quiet.get_from()][quiet.get_to()], -bonus);
         if (prev_move.move != 0) {
-            int prev_piece = prev_move.get_piece();
-            int prev_to = prev_move.get_to();
-            int piece = move.get_piece();
-            int to = move.get_to();
-            int cont_bonus = continuation_history[prev_piece][prev_to][piece][to];
-            if (cont_bonus > 0) {
-                return 17000 + cont_bonus;  // Between countermove and killer
-            }
+            update_history(continuation_history[prev_move.get_piece()][prev_move.get_to()]
+                                               [quiet.get_piece()][quiet.get_to()], -bonus);
         }
     }
+}
+
+int score_move_enhanced(const Position& pos, const Move& move, const Move& tt_move, int ply = 0) {
+    if (move.move == tt_move.move) return 100000; // TT move highest priority
     
     // Winning captures (SEE-based) - Critical improvement
     if (move.is_capture()) {
@@ -2918,10 +4036,15 @@ int score_move_enhanced(const Position& pos, const Move& move, const Move& tt_mo
         if (killer_moves[1][ply].move == move.move) return 19000;
     }
     
-    // History heuristic
-    int piece = move.get_piece();
-    int to = move.get_to();
-    return history_moves[piece][to];
+    // Countermove bonus
+    Move prev_move = ply > 0 ? move_stack[ply - 1] : Move();
+    if (prev_move.move != 0 &&
+        countermoves[prev_move.get_piece()][prev_move.get_to()].move == move.move) {
+        return 18000;  // Just below killer moves
+    }
+    
+    // History heuristic (butterfly + continuation), bounded by 2 * HISTORY_MAX
+    return quiet_history_score(pos, move, prev_move);
 }
 
 void sort_moves_enhanced(const Position& pos, std::vector<Move>& moves, const Move& tt_move, int ply) {
@@ -2938,9 +4061,17 @@ void sort_moves_enhanced(const Position& pos, std::vector<Move>& moves, const Mo
 // REPLACE: Quiescence Search (FIXED with Ply)
 // ========================================
 
-int quiescence(Position& pos, int alpha, int beta, int ply) {
+// Per-ply buffers reused by quiescence so it does not allocate once warmed up
+thread_local std::vector<Move> qsearch_moves[MAX_DEPTH];
+thread_local std::vector<int> qsearch_scores[MAX_DEPTH];
+
+// qdepth is 0 at the first quiescence ply and decreases from there. Quiet
+// checks are only tried at qdepth 0, so those nodes (and evasion nodes) are
+// stored in the TT at depth 0; plain capture nodes are stored at depth -1.
+int quiescence(Position& pos, int alpha, int beta, int ply, int qdepth = 0) {
     if ((nodes_searched & 127) == 0) {
-        if (current_time_ms() - start_time > (time_limit * 99 / 100)) {
+        if (current_time_ms() - start_time > (time_limit * 99 / 100) ||
+            (node_limit > 0 && nodes_searched >= node_limit) || stop_search.load(std::memory_order_relaxed)) {
             time_up = true;
             return 0;
         }
@@ -2949,56 +4080,143 @@ int quiescence(Position& pos, int alpha, int beta, int ply) {
     if (ply >= MAX_DEPTH - 1) return evaluate_position_tapered(pos);
 
     nodes_searched++;
+    pv_length[ply] = 0;
+    if (ply > sel_depth) sel_depth = ply;
+
+    int us = pos.side_to_move;
+    U64 king_bb = pos.pieces[us][K];
+    int king_sq = king_bb ? lsb_index(king_bb) : -1;
+    bool in_check = king_sq >= 0 && is_square_attacked(pos, king_sq, 1 - us);
+    
+    int tt_depth = (in_check || qdepth == 0) ? 0 : -1;
+    int tt_score = 0;
+    Move tt_move;
+    if (probe_tt(pos.hash_key, tt_depth, alpha, beta, tt_score, tt_move, ply)) {
+        return tt_score;
+    }
+    
+    int original_alpha = alpha;
+    Move best_move;
+    
+    // In check there is no stand-pat: every evasion is searched
+    if (in_check) {
+        MoveList evasions = generate_legal_moves(pos);
+        if (evasions.moves.empty()) return -MATE_SCORE + ply;
+        
+        sort_moves_enhanced(pos, evasions.moves, tt_move, ply);
+        for (const auto& move : evasions.moves) {
+            BoardState state = make_move(pos, move);
+            int score = -quiescence(pos, -beta, -alpha, ply + 1, qdepth - 1);
+            unmake_move(pos, move, state);
+            
+            if (time_up) return 0;
+            
+            if (score >= beta) {
+                record_tt(pos.hash_key, beta, TT_BETA, tt_depth, move, ply);
+                return beta;
+            }
+            if (score > alpha) {
+                alpha = score;
+                best_move = move;
+            }
+        }
+        record_tt(pos.hash_key, alpha, alpha > original_alpha ? TT_EXACT : TT_ALPHA, tt_depth, best_move, ply);
+        return alpha;
+    }
 
-    int stand_pat = evaluate_position_tapered(pos);
+    // The lazy window only skips work where stand-pat alone decides the node:
+    // a beta cutoff, or a deficit even a free queen cannot repair
+    int correction = eval_correction(pos);
+    int lazy_alpha = alpha - piece_values[Q] - search_params.delta_pruning_margin - correction;
+    int stand_pat = corrected_eval(pos, evaluate_position(pos, lazy_alpha, beta - correction));
     
-    if (stand_pat + piece_values[Q] + DELTA_PRUNING_MARGIN < alpha) {
+    if (stand_pat + piece_values[Q] + search_params.delta_pruning_margin < alpha) {
         return alpha;
     }
     
     if (stand_pat >= beta) return beta;
     if (stand_pat > alpha) alpha = stand_pat;
 
-    std::vector<Move> captures;
-    generate_captures(pos, captures);
+    std::vector<Move>& moves = qsearch_moves[ply];
+    std::vector<int>& scores = qsearch_scores[ply];
+    moves.clear();
+    generate_captures(pos, moves);
     
-    std::vector<Move> filtered_captures;
-    for (const auto& move : captures) {
-        if (move.is_capture()) {
-            if (see_capture(pos, move) >= -50) {
-                filtered_captures.push_back(move);
+    if (qdepth == 0) {
+        MoveList all_moves = generate_moves(pos);
+        for (const auto& move : all_moves.moves) {
+            if (!move.is_capture() && !move.get_promo() && !move.is_castling() && gives_check(pos, move)) {
+                moves.push_back(move);
             }
-        } else {
-            filtered_captures.push_back(move);
         }
     }
-    captures = filtered_captures;
     
-    sort_moves_enhanced(pos, captures, Move(), 0);
-
-    for (const auto& move : captures) {
-        BoardState state = make_move(pos, move);
+    // Score every move once; hopeless and SEE-losing moves are dropped here
+    scores.resize(moves.size());
+    int count = 0;
+    for (size_t i = 0; i < moves.size(); i++) {
+        Move move = moves[i];
+        int score;
         
-        int our_color = 1 - pos.side_to_move;
-        U64 king_bb = pos.pieces[our_color][K];
-        if (king_bb != 0) {
-            int king_sq = lsb_index(king_bb);
-            if (is_square_attacked(pos, king_sq, pos.side_to_move)) {
-                unmake_move(pos, move, state);
-                continue;
+        if (move.get_promo()) {
+            if (move.get_promo() != Q) continue;
+            score = 2 * piece_values[Q];
+        } else if (move.is_capture()) {
+            int victim = P;
+            if (!move.is_enpassant()) {
+                for (int p = P; p <= Q; p++) {
+                    if (get_bit(pos.pieces[1 - us][p], move.get_to())) {
+                        victim = p;
+                        break;
+                    }
+                }
             }
+            // Delta pruning: even winning this piece for free cannot reach alpha
+            if (stand_pat + piece_values[victim] + search_params.delta_pruning_margin <= alpha) continue;
+            if (!see_ge(pos, move, -50)) continue;
+            score = piece_values[victim] * 8 - move.get_piece();
+        } else {
+            if (!see_ge(pos, move, 0)) continue;
+            score = -1;
+        }
+        
+        if (move.move == tt_move.move) score += 100000;
+        moves[count] = move;
+        scores[count] = score;
+        count++;
+    }
+    
+    U64 pinned = (count > 0 && king_sq >= 0) ? pinned_pieces(pos, us, king_sq) : 0ULL;
+    
+    for (int i = 0; i < count; i++) {
+        // Selection sort: cutoffs usually come early, so a full sort is wasted work
+        int best_index = i;
+        for (int j = i + 1; j < count; j++) {
+            if (scores[j] > scores[best_index]) best_index = j;
         }
+        std::swap(moves[i], moves[best_index]);
+        std::swap(scores[i], scores[best_index]);
+        Move move = moves[i];
         
-        int score = -quiescence(pos, -beta, -alpha, ply + 1);
+        if (king_sq >= 0 && !is_legal_fast(pos, move, king_sq, pinned)) continue;
         
+        BoardState state = make_move(pos, move);
+        int score = -quiescence(pos, -beta, -alpha, ply + 1, qdepth - 1);
         unmake_move(pos, move, state);
         
         if (time_up) return 0;
 
-        if (score >= beta) return beta;
-        if (score > alpha) alpha = score;
+        if (score >= beta) {
+            record_tt(pos.hash_key, beta, TT_BETA, tt_depth, move, ply);
+            return beta;
+        }
+        if (score > alpha) {
+            alpha = score;
+            best_move = move;
+        }
     }
     
+    record_tt(pos.hash_key, alpha, alpha > original_alpha ? TT_EXACT : TT_ALPHA, tt_depth, best_move, ply);
     return alpha;
 }
 
@@ -3006,9 +4224,10 @@ int quiescence(Position& pos, int alpha, int beta, int ply) {
 // REPLACE: Negamax (FIXED with Legal Moves and PV Table)
 // ========================================
 
-int pvs_search(Position& pos, int depth, int alpha, int beta, int ply, bool is_pv_node) {
+int pvs_search(Position& pos, int depth, int alpha, int beta, int ply, bool is_pv_node, bool cut_node) {
     if ((nodes_searched & 127) == 0) {
-        if (current_time_ms() - start_time > (time_limit * 99 / 100)) {
+        if (current_time_ms() - start_time > (time_limit * 99 / 100) ||
+            (node_limit > 0 && nodes_searched >= node_limit) || stop_search.load(std::memory_order_relaxed)) {
             time_up = true;
             return 0;
         }
@@ -3016,12 +4235,19 @@ int pvs_search(Position& pos, int depth, int alpha, int beta, int ply, bool is_p
     if (time_up) return 0;
     if (ply >= MAX_DEPTH - 1) return evaluate_position_tapered(pos);
     
-    pv_length[ply] = ply;
+    pv_length[ply] = 0;
     
     int flag = TT_ALPHA;
     Move best_move_found;
     
     nodes_searched++;
+    if (ply > sel_depth) sel_depth = ply;
+
+    // The side to move can force a repetition of a position inside the tree
+    if (ply > 0 && alpha < 0 && has_upcoming_repetition(pos, ply)) {
+        alpha = 0;
+        if (alpha >= beta) return alpha;
+    }
 
     int tt_score = 0;
     Move tt_move;
@@ -3029,10 +4255,6 @@ int pvs_search(Position& pos, int depth, int alpha, int beta, int ply, bool is_p
         return tt_score;
     }
     
-    if ((nodes_searched & 4095) == 0) {
-        decay_continuation_history();
-    }
-
     if (depth <= 0) {
         return quiescence(pos, alpha, beta, ply);
     }
@@ -3085,7 +4307,7 @@ int pvs_search(Position& pos, int depth, int alpha, int beta, int ply, bool is_p
         }
     }
     
-    if (is_repetition(pos)) {
+    if (ply > 0 && is_repetition(pos, ply)) {
         return 0;
     }
     
@@ -3093,43 +4315,34 @@ int pvs_search(Position& pos, int depth, int alpha, int beta, int ply, bool is_p
         return 0;
     }
 
-    const int RAZOR_MARGIN_BASE = 300;
-    const int RAZOR_MARGIN_DEPTH = 100;
+    // Static eval is computed once and shared by every pruning decision below
+    int raw_eval = in_check ? NO_EVAL : evaluate_position_tapered(pos);
+    int static_eval = in_check ? NO_EVAL : corrected_eval(pos, raw_eval);
+    static_eval_stack[ply] = static_eval;
+    bool improving = !in_check && ply >= 2 && static_eval_stack[ply - 2] != NO_EVAL &&
+                     static_eval > static_eval_stack[ply - 2];
     
     if (depth <= 3 && !in_check && alpha < MATE_SCORE - 100) {
-        int static_eval = evaluate_position_tapered(pos);
-        int razor_margin = RAZOR_MARGIN_BASE + RAZOR_MARGIN_DEPTH * depth;
+        int razor_margin = search_params.razor_margin_base + search_params.razor_margin_depth * depth;
         
         if (static_eval + razor_margin < alpha) {
-            int q_score = quiescence(pos, alpha - razor_margin, alpha - razor_margin + 1, ply);
-            if (q_score + razor_margin < alpha) {
-                std::vector<Move> captures;
-                generate_captures(pos, captures);
-                
-                bool has_good_capture = false;
-                for (const auto& cap : captures) {
-                    if (see_capture(pos, cap) > 0) {
-                        has_good_capture = true;
-                        break;
-                    }
-                }
-                
-                if (!has_good_capture) {
-                    return q_score;
-                }
+            int q_score = quiescence(pos, alpha - 1, alpha, ply);
+            if (q_score < alpha) {
+                return q_score;
             }
         }
     }
 
     if (depth >= 5 && !in_check && !is_pv_node) {
-        int probcut_beta = beta + PROBCUT_MARGIN;
+        int probcut_beta = beta + search_params.probcut_margin;
         std::vector<Move> captures;
         generate_captures(pos, captures);
         
         for (const auto& cap_move : captures) {
-            if (see_capture(pos, cap_move) >= 0) {
+            if (cap_move.is_capture() && see_ge(pos, cap_move, probcut_beta - static_eval)) {
                 BoardState state = make_move(pos, cap_move);
-                int probcut_score = -pvs_search(pos, depth - 3, -probcut_beta, -probcut_beta + 1, ply + 1, false);
+                move_stack[ply] = cap_move;
+                int probcut_score = -pvs_search(pos, depth - 3, -probcut_beta, -probcut_beta + 1, ply + 1, false, !cut_node);
                 unmake_move(pos, cap_move, state);
                 
                 if (probcut_score >= probcut_beta) {
@@ -3139,29 +4352,41 @@ int pvs_search(Position& pos, int depth, int alpha, int beta, int ply, bool is_p
         }
     }
 
-    if (!is_pv_node && depth >= 3 && !in_check && ply > 0) {
+    if (!is_pv_node && depth >= 3 && !in_check && ply > 0 && static_eval >= beta) {
         int non_pawn_material = 0;
         for (int p = N; p <= Q; p++) {
             non_pawn_material += count_bits(pos.pieces[pos.side_to_move][p]) * piece_values[p];
         }
         
         if (non_pawn_material > 400) {
+            // Adaptive reduction: deeper nodes and larger eval margins reduce more
+            int null_r = 3 + depth / 3 + std::min((static_eval - beta) / NULL_MOVE_EVAL_DIVISOR, 3);
+            int null_depth = std::max(0, depth - 1 - null_r);
+            
             pos.side_to_move = 1 - pos.side_to_move;
             pos.hash_key ^= side_key;
+            move_stack[ply] = Move();
+            // Repetitions never span a null move
+            int saved_halfmove_clock = halfmove_clock;
+            halfmove_clock = 0;
+            push_key(pos.hash_key);
             
-            int null_score = -pvs_search(pos, depth - 1 - 2, -beta, -beta + 1, ply + 1, false);
+            int null_score = -pvs_search(pos, null_depth, -beta, -beta + 1, ply + 1, false, !cut_node);
             
+            key_count--;
+            halfmove_clock = saved_halfmove_clock;
             pos.side_to_move = 1 - pos.side_to_move;
             pos.hash_key ^= side_key;
             
             if (null_score >= beta) {
+                if (null_score >= MATE_SCORE - MAX_PLY) null_score = beta;
                 if (depth >= 8) {
-                    int verify_score = pvs_search(pos, depth - 4, beta - 1, beta, ply, false);
+                    int verify_score = pvs_search(pos, null_depth, beta - 1, beta, ply, false, false);
                     if (verify_score >= beta) {
-                        return beta;
+                        return null_score;
                     }
                 } else {
-                    return beta;
+                    return null_score;
                 }
             }
         }
@@ -3183,83 +4408,117 @@ int pvs_search(Position& pos, int depth, int alpha, int beta, int ply, bool is_p
 
     bool futility_pruning = false;
     if (depth <= 3 && !in_check && alpha < MATE_SCORE - 100 && beta > -MATE_SCORE + 100) {
-        int static_eval = evaluate_position_tapered(pos);
-        if (static_eval + FUTILITY_MARGIN * depth < alpha) {
+        if (static_eval + search_params.futility_margin * depth < alpha) {
             futility_pruning = true;
         }
     }
     
     if (depth >= 3 && !in_check && !is_pv_node && alpha > -MATE_SCORE + 100) {
-        int static_eval = evaluate_position_tapered(pos);
-        if (static_eval - REVERSE_FUTILITY_MARGIN * depth > beta) {
-            return static_eval - REVERSE_FUTILITY_MARGIN * depth;
+        if (static_eval - search_params.reverse_futility_margin * depth > beta) {
+            return static_eval - search_params.reverse_futility_margin * depth;
         }
     }
 
+    // Internal iterative reduction: without a TT move, ordering is poor and the
+    // node is probably new, so search it one ply shallower instead
     if (depth >= 4 && tt_move.move == 0) {
-        int iid_depth = depth - 2;
-        (void)-pvs_search(pos, iid_depth, -beta, -alpha, ply + 1, false);
-        Move iid_move;
-        int dummy_score;
-        if (probe_tt(pos.hash_key, iid_depth, alpha, beta, dummy_score, iid_move, ply)) {
-            tt_move = iid_move;
-        }
+        depth--;
     }
     
     sort_moves_enhanced(pos, move_list.moves, tt_move, ply);
 
+    bool tt_move_is_capture = tt_move.move != 0 && tt_move.is_capture();
     bool searched_first_move = false;
+    bool skip_quiets = false;
+    int moves_searched = 0;
+    Move prev_move = ply > 0 ? move_stack[ply - 1] : Move();
+    Move quiets_tried[MAX_QUIETS_TRIED];
+    int quiet_count = 0;
 
     for (size_t i = 0; i < move_list.moves.size(); i++) {
         const Move& move = move_list.moves[i];
+        bool is_quiet = !move.is_capture() && !move.get_promo();
         
-        if (futility_pruning && !move.is_capture() && !move.get_promo()) {
+        if (futility_pruning && is_quiet) {
             continue;
         }
         
+        // Shallow-depth pruning, never before a move has been searched or when mated
+        if (!is_pv_node && !in_check && searched_first_move && alpha > -MATE_SCORE + MAX_PLY) {
+            if (is_quiet) {
+                if (skip_quiets) continue;
+                
+                // Late move pruning: enough quiets tried at this depth
+                if (depth <= LMP_MAX_DEPTH && moves_searched >= lmp_threshold[improving][depth]) {
+                    skip_quiets = true;
+                    continue;
+                }
+                
+                // Continuation-history pruning: quiets that have kept failing here
+                if (depth <= HISTORY_PRUNING_DEPTH && prev_move.move != 0) {
+                    int cont_score = continuation_history[prev_move.get_piece()][prev_move.get_to()]
+                                                         [move.get_piece()][move.get_to()];
+                    if (cont_score < -HISTORY_PRUNING_MARGIN * depth) continue;
+                }
+                
+                if (depth <= SEE_PRUNING_DEPTH && !see_ge(pos, move, -SEE_QUIET_MARGIN * depth)) {
+                    continue;
+                }
+            } else if (depth <= SEE_PRUNING_DEPTH && !see_ge(pos, move, -SEE_CAPTURE_MARGIN * depth * depth)) {
+                continue;
+            }
+        }
+        
         int reduction = 0;
         
-        if (depth >= 3 && i >= 4 && !in_check && !move.is_capture() && !move.get_promo()) {
-            reduction = static_cast<int>(std::log(depth) * std::log(i) / 2.0);
+        if (depth >= 3 && moves_searched >= 4 && !in_check && is_quiet) {
+            reduction = lmr_table[std::min(depth, MAX_DEPTH)][std::min(moves_searched, LMR_MAX_MOVES - 1)];
             
-            int piece = move.get_piece();
-            int to = move.get_to();
-            if (history_moves[piece][to] > 8000) reduction = std::max(0, reduction - 2);
+            // Well-behaved quiets (main + continuation history) are reduced less
+            reduction -= quiet_history_score(pos, move, prev_move) / LMR_HISTORY_DIVISOR;
             
-            if (is_pv_node) reduction = std::max(0, reduction - 1);
+            if (is_pv_node) reduction--;
+            if (!improving) reduction++;
+            if (cut_node) reduction++;
+            if (tt_move_is_capture) reduction++;
             
             if (killer_moves[0][ply].move == move.move ||
                 killer_moves[1][ply].move == move.move) {
-                reduction = std::max(0, reduction - 1);
+                reduction--;
             }
             
-            int piece_type = move.get_piece();
-            int to_square = move.get_to();
-            if (history_moves[piece_type][to_square] > 8000) reduction = std::max(0, reduction - 2);
+            if (gives_check(pos, move)) reduction--;
             
-            reduction = std::min(reduction, depth - 2);
+            reduction = std::max(0, std::min(reduction, depth - 2));
         }
         
+        move_stack[ply] = move;
+        moves_searched++;
         BoardState state = make_move(pos, move);
 
         int score;
+        int new_depth = depth - 1;
         
         if (!searched_first_move) {
-            score = -pvs_search(pos, depth - 1, -beta, -alpha, ply + 1, true);
+            score = -pvs_search(pos, new_depth, -beta, -alpha, ply + 1, is_pv_node, !is_pv_node && !cut_node);
             searched_first_move = true;
         } else {
             if (reduction > 0) {
-                score = -pvs_search(pos, depth - 1 - reduction, -alpha - 1, -alpha, ply + 1, false);
+                score = -pvs_search(pos, new_depth - reduction, -alpha - 1, -alpha, ply + 1, false, true);
                 
+                // Fail-high on the reduced search: try an intermediate depth first
+                if (score > alpha && reduction > 1) {
+                    score = -pvs_search(pos, new_depth - reduction / 2, -alpha - 1, -alpha, ply + 1, false, !cut_node);
+                }
                 if (score > alpha) {
-                    score = -pvs_search(pos, depth - 1, -alpha - 1, -alpha, ply + 1, false);
+                    score = -pvs_search(pos, new_depth, -alpha - 1, -alpha, ply + 1, false, !cut_node);
                 }
             } else {
-                score = -pvs_search(pos, depth - 1, -alpha - 1, -alpha, ply + 1, false);
+                score = -pvs_search(pos, new_depth, -alpha - 1, -alpha, ply + 1, false, !cut_node);
             }
             
-            if (score > alpha && score < beta) {
-                score = -pvs_search(pos, depth - 1, -beta, -alpha, ply + 1, true);
+            if (is_pv_node && score > alpha && score < beta) {
+                score = -pvs_search(pos, new_depth, -beta, -alpha, ply + 1, true, false);
             }
         }
         
@@ -3272,57 +4531,6 @@ int pvs_search(Position& pos, int depth, int alpha, int beta, int ply, bool is_p
             flag = TT_EXACT;
             best_move_found = move;
             
-            if (ply < MAX_DEPTH) {
-                if (killer_moves[0][ply].move != move.move) {
-                    killer_moves[1][ply] = killer_moves[0][ply];
-                    killer_moves[0][ply] = move;
-                }
-            }
-            
-            if (ply < MAX_DEPTH && !move.is_capture()) {
-                int piece = move.get_piece();
-                int to = move.get_to();
-                if (history_moves[piece][to] < HISTORY_MAX) {
-                    history_moves[piece][to] += depth * depth;
-                }
-                
-                if (ply > 0) {
-                    Move prev_move = pv_table[ply - 1][0];
-                    if (prev_move.move != 0) {
-                        int prev_piece = prev_move.get_piece();
-                        int prev_to = prev_move.get_to();
-                        if (continuation_history[prev_piece][prev_to][piece][to] < HISTORY_MAX) {
-                            continuation_history[prev_piece][prev_to][piece][to] += depth * depth;
-                        }
-                    }
-                }
-            }
-            
-            if (ply < MAX_DEPTH && move.is_capture() && score >= beta) {
-                int piece = move.get_piece();
-                int to = move.get_to();
-                int victim = P;
-                int enemy = 1 - pos.side_to_move;
-                for (int p = 0; p < 6; p++) {
-                    if (get_bit(pos.pieces[enemy][p], to)) {
-                        victim = p;
-                        break;
-                    }
-                }
-                if (capture_history[piece][to][victim] < HISTORY_MAX) {
-                    capture_history[piece][to][victim] += depth * depth;
-                }
-            }
-
-            if (ply > 0 && !move.is_capture() && score >= beta) {
-                Move prev_move = pv_table[ply - 1][0];
-                if (prev_move.move != 0) {
-                    int prev_piece = prev_move.get_piece();
-                    int prev_to = prev_move.get_to();
-                    countermoves[prev_piece][prev_to] = move;
-                }
-            }
-            
             pv_table[ply][0] = move;
             pv_length[ply] = 1;
             for (int i = 0; i < pv_length[ply + 1] && i < MAX_PLY - ply - 1; i++) {
@@ -3331,12 +4539,28 @@ int pvs_search(Position& pos, int depth, int alpha, int beta, int ply, bool is_p
             }
             
             if (alpha >= beta) {
+                update_cutoff_history(pos, move, depth, ply, prev_move, quiets_tried, quiet_count);
+                if (!in_check && is_quiet && beta > static_eval && beta < MATE_SCORE - MAX_PLY) {
+                    update_correction_history(pos, depth, beta - raw_eval);
+                }
                 record_tt(pos.hash_key, beta, TT_BETA, depth, move, ply);
                 return beta;
             }
         }
+        
+        if (is_quiet && quiet_count < MAX_QUIETS_TRIED) {
+            quiets_tried[quiet_count++] = move;
+        }
     }
 
+    // Exact scores and fail-lows below the static eval teach the correction table
+    bool best_is_quiet = best_move_found.move == 0 ||
+                         (!best_move_found.is_capture() && !best_move_found.get_promo());
+    if (!in_check && best_is_quiet && std::abs(alpha) < MATE_SCORE - MAX_PLY &&
+        (flag == TT_EXACT || alpha < static_eval)) {
+        update_correction_history(pos, depth, alpha - raw_eval);
+    }
+    
     record_tt(pos.hash_key, alpha, flag, depth, best_move_found, ply);
     return alpha;
 }
@@ -3378,214 +4602,247 @@ void print_move_uci(int move_int) {
 // This was causing performance degradation due to thread overhead
 // without actual parallel search benefit
 
-Move search_position(Position& pos) {
-    time_up = false;
-    nodes_searched = 0;
-    start_time = current_time_ms();
-    stop_search.store(false);
-    best_depth.store(0);
-    best_worker_score.store(-INFINITY_SCORE);
-    
-    // Clear PV table
-    memset(pv_table, 0, sizeof(pv_table));
-    memset(pv_length, 0, sizeof(pv_length));
-    
-    // DON'T clear position_history or halfmove_clock here!
-    // They should persist across searches for repetition detection!
-    
-    Move best_move;
-    bool found_move = false;
-    int prev_score = 0;
+// UCI info line for an iteration; bounds are reported for aspiration failures
+enum { BOUND_EXACT, BOUND_LOWER, BOUND_UPPER };
+
+void print_search_info(int depth, const RootMove& rm, int bound) {
+    if (search_silent) return;
+    int score = rm.score;
+    std::cout << "info depth " << depth << " seldepth " << rm.sel_depth;
     
-    // Initialize thread data
-    thread_data.resize(MAX_THREADS);
-    for (int i = 0; i < MAX_THREADS; i++) {
-        thread_data[i].depth = 0;
-        thread_data[i].nodes = 0;
+    // FIX: Stricter mate score detection
+    // Only treat as mate if score is VERY close to MATE_SCORE
+    if (score >= MATE_SCORE - 10) {
+        std::cout << " score mate " << (MATE_SCORE - score + 1) / 2;
+    } else if (score <= -MATE_SCORE + 100) {  // FIX: Much stricter threshold
+        std::cout << " score mate -" << (MATE_SCORE + score) / 2;
+    } else {
+        // Normal centipawn score (using named constants)
+        if (score > EVAL_CLAMP_MAX) score = EVAL_CLAMP_MAX;
+        if (score < EVAL_CLAMP_MIN) score = EVAL_CLAMP_MIN;
+        std::cout << " score cp " << score;
     }
+    if (bound == BOUND_LOWER) std::cout << " lowerbound";
+    if (bound == BOUND_UPPER) std::cout << " upperbound";
     
-    // REMOVED: Broken Lazy SMP implementation
-    // This was causing performance degradation due to thread overhead
-    // without actual parallel search benefit
+    std::cout << " nodes " << nodes_searched << " time " << (current_time_ms() - start_time) << " pv";
+    for (size_t i = 0; i < rm.pv.size() && i < 10; i++) {
+        std::cout << " ";
+        print_move_uci(rm.pv[i].move);
+    }
+    std::cout << std::endl;
+}
+
+// Search all root moves once: full window for the first, zero window + re-search
+// for the rest. Returns the best score; root_moves is updated in place.
+int search_root(Position& pos, int depth, int alpha, int beta) {
+    int best_score = -INFINITY_SCORE;
     
-    for (int depth = 1; depth <= MAX_DEPTH && !time_up; depth++) {
-        int alpha, beta;
+    for (size_t i = 0; i < root_moves.size(); i++) {
+        RootMove& rm = root_moves[i];
         
-        // Aspiration windows (narrow search window for speed)
-        int original_alpha, original_beta;
-        if (depth >= 5) {
-            original_alpha = prev_score - ASPIRATION_WINDOW;  // 0.5 pawn window
-            original_beta = prev_score + ASPIRATION_WINDOW;
-            alpha = original_alpha;
-            beta = original_beta;
-        } else {
-            original_alpha = -INFINITY_SCORE;
-            original_beta = INFINITY_SCORE;
-            alpha = -INFINITY_SCORE;
-            beta = INFINITY_SCORE;
+        // ADDED: Check time at root level
+        if (current_time_ms() - start_time > time_limit || (node_limit > 0 && nodes_searched >= node_limit) ||
+            stop_search.load(std::memory_order_relaxed)) {
+            time_up = true;
+            break;
         }
         
-        // Generate moves ONCE before the loop
-        MoveList moves = generate_legal_moves(pos);
+        long long nodes_before = nodes_searched;
+        sel_depth = 0;
         
-        if (moves.moves.empty()) {
-            // No moves available - game over
-            std::cout << "info string No legal moves found - game over" << std::endl;
-            break;
+        BoardState state = make_move(pos, rm.move);
+        move_stack[0] = rm.move;
+        
+        int score;
+        if (i == 0) {
+            score = -pvs_search(pos, depth - 1, -beta, -alpha, 1, true, false);
+        } else {
+            score = -pvs_search(pos, depth - 1, -alpha - 1, -alpha, 1, false, true);
+            if (score > alpha && score < beta) {
+                score = -pvs_search(pos, depth - 1, -beta, -alpha, 1, true, false);
+            }
+        }
+        
+        unmake_move(pos, rm.move, state);  // Always unmake!
+        
+        if (time_up) break;
+        
+        rm.nodes += nodes_searched - nodes_before;
+        
+        if (i == 0 || score > alpha) {
+            rm.score = score;
+            rm.sel_depth = sel_depth;
+            rm.pv.assign(1, rm.move);
+            for (int j = 0; j < pv_length[1] && j < MAX_PLY - 1; j++) {
+                rm.pv.push_back(pv_table[1][j]);
+            }
+        } else {
+            rm.score = -INFINITY_SCORE;
         }
         
-        // Phase 4: Early exit on forced moves
-        if (moves.moves.size() == 1) {
-            // Only one legal move, return it immediately
-            best_move = moves.moves[0];
-            std::cout << "info depth " << depth << " score cp 0 nodes " << nodes_searched
+        if (score > best_score) best_score = score;
+        if (score > alpha) {
+            alpha = score;
+            if (alpha >= beta) break;
+        }
+    }
+    
+    // Best move first; moves that were not resolved keep last-iteration order,
+    // with larger subtrees (harder to refute) ahead of smaller ones
+    std::stable_sort(root_moves.begin(), root_moves.end(), [](const RootMove& a, const RootMove& b) {
+        if (a.score != b.score) return a.score > b.score;
+        if (a.previous_score != b.previous_score) return a.previous_score > b.previous_score;
+        return a.nodes > b.nodes;
+    });
+    
+    return best_score;
+}
+
+Move search_position(Position& pos) {
+    time_up = false;
+    nodes_searched = 0;
+    start_time = current_time_ms();
+    best_depth.store(0);
+    best_worker_score.store(-INFINITY_SCORE);
+    
+    // Clear PV table
+    memset(pv_table, 0, sizeof(pv_table));
+    memset(pv_length, 0, sizeof(pv_length));
+    
+    // Reset search stack
+    std::fill(std::begin(move_stack), std::end(move_stack), Move());
+    for (int i = 0; i <= MAX_PLY; i++) static_eval_stack[i] = NO_EVAL;
+    
+    // Keep history from the previous move, but let it fade
+    age_history();
+    
+    // Root accumulators are computed from scratch on first use
+    nnue_reset_stack();
+    eval_stats = EvalStats();
+    if (lmr_table_divisor != search_params.lmr_divisor) init_lmr_table();
+    root_score = 0;
+    
+    // DON'T clear the key stack or halfmove_clock here!
+    // They should persist across searches for repetition detection!
+    
+    Move best_move;
+    int prev_score = 0;
+    
+    // Initialize thread data
+    thread_data.resize(MAX_THREADS);
+    for (int i = 0; i < MAX_THREADS; i++) {
+        thread_data[i].depth = 0;
+        thread_data[i].nodes = 0;
+    }
+    
+    // Root moves are generated once and reordered between iterations
+    MoveList moves = generate_legal_moves(pos);
+    
+    if (moves.moves.empty()) {
+        // No moves available - game over
+        if (!search_silent) std::cout << "info string No legal moves found - game over" << std::endl;
+        return best_move;
+    }
+    
+    // Phase 4: Early exit on forced moves
+    if (moves.moves.size() == 1) {
+        // Only one legal move, return it immediately
+        best_move = moves.moves[0];
+        if (!search_silent) {
+            std::cout << "info depth 1 score cp 0 nodes " << nodes_searched
                       << " time " << (current_time_ms() - start_time) << " pv ";
             print_move_uci(best_move.move);
             std::cout << std::endl;
-            return best_move;
+        }
+        return best_move;
+    }
+    
+    // Initial order: TT move first, then the usual move ordering
+    Move tt_move;
+    int dummy_score;
+    probe_tt(pos.hash_key, 0, -INFINITY_SCORE, INFINITY_SCORE, dummy_score, tt_move, 0);
+    sort_moves_enhanced(pos, moves.moves, tt_move, 0);
+    
+    root_moves.clear();
+    for (const auto& move : moves.moves) {
+        RootMove rm;
+        rm.move = move;
+        root_moves.push_back(rm);
+    }
+    
+    for (int depth = 1; depth <= depth_limit && !time_up; depth++) {
+        for (auto& rm : root_moves) {
+            rm.previous_score = rm.score;
+            rm.score = -INFINITY_SCORE;
+        }
+        
+        // Aspiration windows (narrow search window for speed). On failure only the
+        // failing side is widened, geometrically; repeated fail-highs are
+        // re-searched up to 2 plies shallower, but only a full-depth result is
+        // adopted
+        int delta = search_params.aspiration_window;
+        int alpha = -INFINITY_SCORE, beta = INFINITY_SCORE;
+        if (depth >= 5) {
+            alpha = std::max(prev_score - delta, -INFINITY_SCORE);
+            beta = std::min(prev_score + delta, INFINITY_SCORE);
         }
         
-        Move depth_best_move;
         int best_score = -INFINITY_SCORE;
+        int fail_high_count = 0;
         
-        // Search each move WITHOUT modifying the loop
-        // Sort moves at root for better move ordering
-        Move tt_move;
-        int dummy_score;
-        probe_tt(pos.hash_key, depth, alpha, beta, dummy_score, tt_move, 0);
-        sort_moves_enhanced(pos, moves.moves, tt_move, 0);
-        
-        // REMOVED: Broken Lazy SMP implementation
-        // This was causing performance degradation due to thread overhead
-        // without actual parallel search benefit
-        
-        for (const auto& move : moves.moves) {
-            // ADDED: Check time at root level
-            if (current_time_ms() - start_time > time_limit) {
-                time_up = true;
-                break;
-            }
-            
-            BoardState state = make_move(pos, move);
-            int score = -pvs_search(pos, depth - 1, -beta, -alpha, 1, true);
-            
-            // REMOVED: Broken Lazy SMP implementation
-            // This was causing performance degradation due to thread overhead
-            // without actual parallel search benefit
+        while (true) {
+            int search_depth = std::max(1, depth - std::min(fail_high_count, 2));
+            for (auto& rm : root_moves) rm.score = -INFINITY_SCORE;
             
-            unmake_move(pos, move, state);  // Always unmake!
-
+            best_score = search_root(pos, search_depth, alpha, beta);
             if (time_up) break;
-
-            if (score > best_score) {
-                best_score = score;
-                depth_best_move = move;
-                found_move = true;
-                
-                // FIX: Update PV at root (ply 0)
-                pv_table[0][0] = move;
-                pv_length[0] = 1;
-                
-                // Copy PV from deeper plies
-                for (int j = 0; j < pv_length[1] && j < MAX_PLY - 1; j++) {
-                    pv_table[0][pv_length[0]] = pv_table[1][j];
-                    pv_length[0]++;
-                }
-            }
-
-            if (score > alpha) alpha = score;
-        }
-        
-        // Re-search if outside aspiration window
-        if (depth >= 5 && !time_up && (best_score <= original_alpha || best_score >= original_beta)) {
-            // Re-search ALL moves with full window
-            alpha = -INFINITY_SCORE;
-            beta = INFINITY_SCORE;
-            best_score = -INFINITY_SCORE;
             
-            for (const auto& move : moves.moves) {
-                BoardState state = make_move(pos, move);
-                int score = -pvs_search(pos, depth - 1, -beta, -alpha, 1, true);
-                unmake_move(pos, move, state);
-                
-                if (score > best_score) {
-                    best_score = score;
-                    depth_best_move = move;
-                }
-                if (score > alpha) alpha = score;
+            if (best_score <= alpha) {
+                print_search_info(depth, root_moves[0], BOUND_UPPER);
+                beta = (alpha + beta) / 2;
+                alpha = std::max(best_score - delta, -INFINITY_SCORE);
+                fail_high_count = 0;
+            } else if (best_score >= beta) {
+                // search_root sorted the failing move first, so it is re-searched first
+                // Below the root the search is fail-hard, so the score is only
+                // a bound: jump beta rather than creeping up by one window
+                print_search_info(depth, root_moves[0], BOUND_LOWER);
+                beta = std::min(best_score + 2 * delta, INFINITY_SCORE);
+                fail_high_count++;
+            } else if (search_depth < depth) {
+                // Inside the window at reduced depth: confirm at full depth
+                fail_high_count = 0;
+                continue;
+            } else {
+                break;
             }
             
-            // Update PV after re-search - FIXED: Clear and rebuild PV properly
-            if (depth_best_move.move != 0) {
-                pv_table[0][0] = depth_best_move;
-                pv_length[0] = 1;
-                
-                // Copy PV from deeper plies (same as normal search)
-                for (int j = 0; j < pv_length[1] && j < MAX_PLY - 1; j++) {
-                    pv_table[0][pv_length[0]] = pv_table[1][j];
-                    pv_length[0]++;
-                }
-            }
+            delta += delta / 2;
         }
         
-        if (!time_up && found_move) {
-            best_move = depth_best_move;
+        if (!time_up) {
+            best_move = root_moves[0].move;
             prev_score = best_score;
-            
-            // FIX: Stricter mate score detection
-            // Only treat as mate if score is VERY close to MATE_SCORE
-            if (best_score >= MATE_SCORE - 10) {
-                int mate_in = (MATE_SCORE - best_score + 1) / 2;
-                std::cout << "info depth " << depth << " score mate " << mate_in
-                          << " nodes " << nodes_searched << " time " << (current_time_ms() - start_time)
-                          << " pv ";
-                for (int i = 0; i < pv_length[0] && i < 10; i++) {
-                    print_move_uci(pv_table[0][i].move);
-                    std::cout << " ";
-                }
-                std::cout << std::endl;
-            } else if (best_score <= -MATE_SCORE + 100) {  // FIX: Much stricter threshold
-                int mate_in = (MATE_SCORE + best_score) / 2;  // FIX: Correct calculation
-                std::cout << "info depth " << depth << " score mate -" << mate_in
-                          << " nodes " << nodes_searched << " time " << (current_time_ms() - start_time)
-                          << " pv ";
-                for (int i = 0; i < pv_length[0] && i < 10; i++) {
-                    print_move_uci(pv_table[0][i].move);
-                    std::cout << " ";
-                }
-                std::cout << std::endl;
-            } else {
-                // Normal centipawn score (using named constants)
-                int clamped_score = best_score;
-                if (clamped_score > EVAL_CLAMP_MAX) clamped_score = EVAL_CLAMP_MAX;
-                if (clamped_score < EVAL_CLAMP_MIN) clamped_score = EVAL_CLAMP_MIN;
-                std::cout << "info depth " << depth << " score cp " << clamped_score
-                          << " nodes " << nodes_searched << " time " << (current_time_ms() - start_time)
-                          << " pv ";
-                for (int i = 0; i < pv_length[0] && i < 10; i++) {
-                    print_move_uci(pv_table[0][i].move);
-                    std::cout << " ";
-                }
-                std::cout << std::endl;
-            }
+            root_score = best_score;
+            print_search_info(depth, root_moves[0], BOUND_EXACT);
         }
         
         // REMOVED: Don't stop searching on mate scores
         // This was causing the engine to resign prematurely
-        // if (best_score >= MATE_SCORE - 10 || best_score <= -MATE_SCORE + 10) {
-        //     break;
-        // }
     }
     
-    // REMOVED: Broken Lazy SMP implementation
-    // This was causing performance degradation due to thread overhead
-    // without actual parallel search benefit
+    // Iteration cut short before any completed: fall back to the ordered first move
+    if (best_move.move == 0) {
+        best_move = root_moves[0].move;
+    }
     
-    // Add PV fallback code if PV is empty but we found a move
-    if (pv_length[0] == 0 && found_move) {
-        // Manually set PV to best move
-        pv_table[0][0] = best_move;
-        pv_length[0] = 1;
+    if (!search_silent) {
+        std::cout << "info string eval material " << eval_stats.material
+                  << " lazy " << eval_stats.lazy
+                  << " full " << eval_stats.full
+                  << " network " << eval_stats.network
+                  << " bitbase " << eval_stats.bitbase << std::endl;
     }
     
     return best_move;
@@ -3595,6 +4852,325 @@ Move search_position(Position& pos) {
 // 13. Search (FIXED) - Keep for compatibility
 // ========================================
 
+// ========================================
+// Opening Book (Polyglot)
+// ========================================
+// Polyglot .bin books: 16-byte big-endian entries (key, move, weight, learn)
+// sorted by key. Polyglot keys use their own fixed random table, so they are
+// computed from scratch for the root position instead of being maintained
+// in make_move alongside hash_key.
+
+// Random64 from the Polyglot book format specification: 768 piece-square
+// entries (64 per piece kind, black pawn first), 4 castling, 8 en passant
+// files, 1 side to move
+const U64 polyglot_random[781] = {
+    0x9D39247E33776D41ULL, 0x2AF7398005AAA5C7ULL, 0x44DB015024623547ULL, 0x9C15F73E62A76AE2ULL,
+    0x75834465489C0C89ULL, 0x3290AC3A203001BFULL, 0x0FBBAD1F61042279ULL, 0xE83A908FF2FB60CAULL,
+    0x0D7E765D58755C10ULL, 0x1A083822CEAFE02DULL, 0x9605D5F0E25EC3B0ULL, 0xD021FF5CD13A2ED5ULL,
+    0x40BDF15D4A672E32ULL, 0x011355146FD56395ULL, 0x5DB4832046F3D9E5ULL, 0x239F8B2D7FF719CCULL,
+    0x05D1A1AE85B49AA1ULL, 0x679F848F6E8FC971ULL, 0x7449BBFF801FED0BULL, 0x7D11CDB1C3B7ADF0ULL,
+    0x82C7709E781EB7CCULL, 0xF3218F1C9510786CULL, 0x331478F3AF51BBE6ULL, 0x4BB38DE5E7219443ULL,
+    0xAA649C6EBCFD50FCULL, 0x8DBD98A352AFD40BULL, 0x87D2074B81D79217ULL, 0x19F3C751D3E92AE1ULL,
+    0xB4AB30F062B19ABFULL, 0x7B0500AC42047AC4ULL, 0xC9452CA81A09D85DULL, 0x24AA6C514DA27500ULL,
+    0x4C9F34427501B447ULL, 0x14A68FD73C910841ULL, 0xA71B9B83461CBD93ULL, 0x03488B95B0F1850FULL,
+    0x637B2B34FF93C040ULL, 0x09D1BC9A3DD90A94ULL, 0x3575668334A1DD3BULL, 0x735E2B97A4C45A23ULL,
+    0x18727070F1BD400BULL, 0x1FCBACD259BF02E7ULL, 0xD310A7C2CE9B6555ULL, 0xBF983FE0FE5D8244ULL,
+    0x9F74D14F7454A824ULL, 0x51EBDC4AB9BA3035ULL, 0x5C82C505DB9AB0FAULL, 0xFCF7FE8A3430B241ULL,
+    0x3253A729B9BA3DDEULL, 0x8C74C368081B3075ULL, 0xB9BC6C87167C33E7ULL, 0x7EF48F2B83024E20ULL,
+    0x11D505D4C351BD7FULL, 0x6568FCA92C76A243ULL, 0x4DE0B0F40F32A7B8ULL, 0x96D693460CC37E5DULL,
+    0x42E240CB63689F2FULL, 0x6D2BDCDAE2919661ULL, 0x42880B0236E4D951ULL, 0x5F0F4A5898171BB6ULL,
+    0x39F890F579F92F88ULL, 0x93C5B5F47356388BULL, 0x63DC359D8D231B78ULL, 0xEC16CA8AEA98AD76ULL,
+    0x5355F900C2A82DC7ULL, 0x07FB9F855A997142ULL, 0x5093417AA8A7ED5EULL, 0x7BCBC38DA25A7F3CULL,
+    0x19FC8A768CF4B6D4ULL, 0x637A7780DECFC0D9ULL, 0x8249A47AEE0E41F7ULL, 0x79AD695501E7D1E8ULL,
+    0x14ACBAF4777D5776ULL, 0xF145B6BECCDEA195ULL, 0xDABF2AC8201752FCULL, 0x24C3C94DF9C8D3F6ULL,
+    0xBB6E2924F03912EAULL, 0x0CE26C0B95C980D9ULL, 0xA49CD132BFBF7CC4ULL, 0xE99D662AF4243939ULL,
+    0x27E6AD7891165C3FULL, 0x8535F040B9744FF1ULL, 0x54B3F4FA5F40D873ULL, 0x72B12C32127FED2BULL,
+    0xEE954D3C7B411F47ULL, 0x9A85AC909A24EAA1ULL, 0x70AC4CD9F04F21F5ULL, 0xF9B89D3E99A075C2ULL,
+    0x87B3E2B2B5C907B1ULL, 0xA366E5B8C54F48B8ULL, 0xAE4A9346CC3F7CF2ULL, 0x1920C04D47267BBDULL,
+    0x87BF02C6B49E2AE9ULL, 0x092237AC237F3859ULL, 0xFF07F64EF8ED14D0ULL, 0x8DE8DCA9F03CC54EULL,
+    0x9C1633264DB49C89ULL, 0xB3F22C3D0B0B38EDULL, 0x390E5FB44D01144BULL, 0x5BFEA5B4712768E9ULL,
+    0x1E1032911FA78984ULL, 0x9A74ACB964E78CB3ULL, 0x4F80F7A035DAFB04ULL, 0x6304D09A0B3738C4ULL,
+    0x2171E64683023A08ULL, 0x5B9B63EB9CEFF80CULL, 0x506AACF489889342ULL, 0x1881AFC9A3A701D6ULL,
+    0x6503080440750644ULL, 0xDFD395339CDBF4A7ULL, 0xEF927DBCF00C20F2ULL, 0x7B32F7D1E03680ECULL,
+    0xB9FD7620E7316243ULL, 0x05A7E8A57DB91B77ULL, 0xB5889C6E15630A75ULL, 0x4A750A09CE9573F7ULL,
+    0xCF464CEC899A2F8AULL, 0xF538639CE705B824ULL, 0x3C79A0FF5580EF7FULL, 0xEDE6C87F8477609DULL,
+    0x799E81F05BC93F31ULL, 0x86536B8CF3428A8CULL, 0x97D7374C60087B73ULL, 0xA246637CFF328532ULL,
+    0x043FCAE60CC0EBA0ULL, 0x920E449535DD359EULL, 0x70EB093B15B290CCULL, 0x73A1921916591CBDULL,
+    0x56436C9FE1A1AA8DULL, 0xEFAC4B70633B8F81ULL, 0xBB215798D45DF7AFULL, 0x45F20042F24F1768ULL,
+    0x930F80F4E8EB7462ULL, 0xFF6712FFCFD75EA1ULL, 0xAE623FD67468AA70ULL, 0xDD2C5BC84BC8D8FCULL,
+    0x7EED120D54CF2DD9ULL, 0x22FE545401165F1CULL, 0xC91800E98FB99929ULL, 0x808BD68E6AC10365ULL,
+    0xDEC468145B7605F6ULL, 0x1BEDE3A3AEF53302ULL, 0x43539603D6C55602ULL, 0xAA969B5C691CCB7AULL,
+    0xA87832D392EFEE56ULL, 0x65942C7B3C7E11AEULL, 0xDED2D633CAD004F6ULL, 0x21F08570F420E565ULL,
+    0xB415938D7DA94E3CULL, 0x91B859E59ECB6350ULL, 0x10CFF333E0ED804AULL, 0x28AED140BE0BB7DDULL,
+    0xC5CC1D89724FA456ULL, 0x5648F680F11A2741ULL, 0x2D255069F0B7DAB3ULL, 0x9BC5A38EF729ABD4ULL,
+    0xEF2F054308F6A2BCULL, 0xAF2042F5CC5C2858ULL, 0x480412BAB7F5BE2AULL, 0xAEF3AF4A563DFE43ULL,
+    0x19AFE59AE451497FULL, 0x52593803DFF1E840ULL, 0xF4F076E65F2CE6F0ULL, 0x11379625747D5AF3ULL,
+    0xBCE5D2248682C115ULL, 0x9DA4243DE836994FULL, 0x066F70B33FE09017ULL, 0x4DC4DE189B671A1CULL,
+    0x51039AB7712457C3ULL, 0xC07A3F80C31FB4B4ULL, 0xB46EE9C5E64A6E7CULL, 0xB3819A42ABE61C87ULL,
+    0x21A007933A522A20ULL, 0x2DF16F761598AA4FULL, 0x763C4A1371B368FDULL, 0xF793C46702E086A0ULL,
+    0xD7288E012AEB8D31ULL, 0xDE336A2A4BC1C44BULL, 0x0BF692B38D079F23ULL, 0x2C604A7A177326B3ULL,
+    0x4850E73E03EB6064ULL, 0xCFC447F1E53C8E1BULL, 0xB05CA3F564268D99ULL, 0x9AE182C8BC9474E8ULL,
+    0xA4FC4BD4FC5558CAULL, 0xE755178D58FC4E76ULL, 0x69B97DB1A4C03DFEULL, 0xF9B5B7C4ACC67C96ULL,
+    0xFC6A82D64B8655FBULL, 0x9C684CB6C4D24417ULL, 0x8EC97D2917456ED0ULL, 0x6703DF9D2924E97EULL,
+    0xC547F57E42A7444EULL, 0x78E37644E7CAD29EULL, 0xFE9A44E9362F05FAULL, 0x08BD35CC38336615ULL,
+    0x9315E5EB3A129ACEULL, 0x94061B871E04DF75ULL, 0xDF1D9F9D784BA010ULL, 0x3BBA57B68871B59DULL,
+    0xD2B7ADEEDED1F73FULL, 0xF7A255D83BC373F8ULL, 0xD7F4F2448C0CEB81ULL, 0xD95BE88CD210FFA7ULL,
+    0x336F52F8FF4728E7ULL, 0xA74049DAC312AC71ULL, 0xA2F61BB6E437FDB5ULL, 0x4F2A5CB07F6A35B3ULL,
+    0x87D380BDA5BF7859ULL, 0x16B9F7E06C453A21ULL, 0x7BA2484C8A0FD54EULL, 0xF3A678CAD9A2E38CULL,
+    0x39B0BF7DDE437BA2ULL, 0xFCAF55C1BF8A4424ULL, 0x18FCF680573FA594ULL, 0x4C0563B89F495AC3ULL,
+    0x40E087931A00930DULL, 0x8CFFA9412EB642C1ULL, 0x68CA39053261169FULL, 0x7A1EE967D27579E2ULL,
+    0x9D1D60E5076F5B6FULL, 0x3810E399B6F65BA2ULL, 0x32095B6D4AB5F9B1ULL, 0x35CAB62109DD038AULL,
+    0xA90B24499FCFAFB1ULL, 0x77A225A07CC2C6BDULL, 0x513E5E634C70E331ULL, 0x4361C0CA3F692F12ULL,
+    0xD941ACA44B20A45BULL, 0x528F7C8602C5807BULL, 0x52AB92BEB9613989ULL, 0x9D1DFA2EFC557F73ULL,
+    0x722FF175F572C348ULL, 0x1D1260A51107FE97ULL, 0x7A249A57EC0C9BA2ULL, 0x04208FE9E8F7F2D6ULL,
+    0x5A110C6058B920A0ULL, 0x0CD9A497658A5698ULL, 0x56FD23C8F9715A4CULL, 0x284C847B9D887AAEULL,
+    0x04FEABFBBDB619CBULL, 0x742E1E651C60BA83ULL, 0x9A9632E65904AD3CULL, 0x881B82A13B51B9E2ULL,
+    0x506E6744CD974924ULL, 0xB0183DB56FFC6A79ULL, 0x0ED9B915C66ED37EULL, 0x5E11E86D5873D484ULL,
+    0xF678647E3519AC6EULL, 0x1B85D488D0F20CC5ULL, 0xDAB9FE6525D89021ULL, 0x0D151D86ADB73615ULL,
+    0xA865A54EDCC0F019ULL, 0x93C42566AEF98FFBULL, 0x99E7AFEABE000731ULL, 0x48CBFF086DDF285AULL,
+    0x7F9B6AF1EBF78BAFULL, 0x58627E1A149BBA21ULL, 0x2CD16E2ABD791E33ULL, 0xD363EFF5F0977996ULL,
+    0x0CE2A38C344A6EEDULL, 0x1A804AADB9CFA741ULL, 0x907F30421D78C5DEULL, 0x501F65EDB3034D07ULL,
+    0x37624AE5A48FA6E9ULL, 0x957BAF61700CFF4EULL, 0x3A6C27934E31188AULL, 0xD49503536ABCA345ULL,
+    0x088E049589C432E0ULL, 0xF943AEE7FEBF21B8ULL, 0x6C3B8E3E336139D3ULL, 0x364F6FFA464EE52EULL,
+    0xD60F6DCEDC314222ULL, 0x56963B0DCA418FC0ULL, 0x16F50EDF91E513AFULL, 0xEF1955914B609F93ULL,
+    0x565601C0364E3228ULL, 0xECB53939887E8175ULL, 0xBAC7A9A18531294BULL, 0xB344C470397BBA52ULL,
+    0x65D34954DAF3CEBDULL, 0xB4B81B3FA97511E2ULL, 0xB422061193D6F6A7ULL, 0x071582401C38434DULL,
+    0x7A13F18BBEDC4FF5ULL, 0xBC4097B116C524D2ULL, 0x59B97885E2F2EA28ULL, 0x99170A5DC3115544ULL,
+    0x6F423357E7C6A9F9ULL, 0x325928EE6E6F8794ULL, 0xD0E4366228B03343ULL, 0x565C31F7DE89EA27ULL,
+    0x30F5611484119414ULL, 0xD873DB391292ED4FULL, 0x7BD94E1D8E17DEBCULL, 0xC7D9F16864A76E94ULL,
+    0x947AE053EE56E63CULL, 0xC8C93882F9475F5FULL, 0x3A9BF55BA91F81CAULL, 0xD9A11FBB3D9808E4ULL,
+    0x0FD22063EDC29FCAULL, 0xB3F256D8ACA0B0B9ULL, 0xB03031A8B4516E84ULL, 0x35DD37D5871448AFULL,
+    0xE9F6082B05542E4EULL, 0xEBFAFA33D7254B59ULL, 0x9255ABB50D532280ULL, 0xB9AB4CE57F2D34F3ULL,
+    0x693501D628297551ULL, 0xC62C58F97DD949BFULL, 0xCD454F8F19C5126AULL, 0xBBE83F4ECC2BDECBULL,
+    0xDC842B7E2819E230ULL, 0xBA89142E007503B8ULL, 0xA3BC941D0A5061CBULL, 0xE9F6760E32CD8021ULL,
+    0x09C7E552BC76492FULL, 0x852F54934DA55CC9ULL, 0x8107FCCF064FCF56ULL, 0x098954D51FFF6580ULL,
+    0x23B70EDB1955C4BFULL, 0xC330DE426430F69DULL, 0x4715ED43E8A45C0AULL, 0xA8D7E4DAB780A08DULL,
+    0x0572B974F03CE0BBULL, 0xB57D2E985E1419C7ULL, 0xE8D9ECBE2CF3D73FULL, 0x2FE4B17170E59750ULL,
+    0x11317BA87905E790ULL, 0x7FBF21EC8A1F45ECULL, 0x1725CABFCB045B00ULL, 0x964E915CD5E2B207ULL,
+    0x3E2B8BCBF016D66DULL, 0xBE7444E39328A0ACULL, 0xF85B2B4FBCDE44B7ULL, 0x49353FEA39BA63B1ULL,
+    0x1DD01AAFCD53486AULL, 0x1FCA8A92FD719F85ULL, 0xFC7C95D827357AFAULL, 0x18A6A990C8B35EBDULL,
+    0xCCCB7005C6B9C28DULL, 0x3BDBB92C43B17F26ULL, 0xAA70B5B4F89695A2ULL, 0xE94C39A54A98307FULL,
+    0xB7A0B174CFF6F36EULL, 0xD4DBA84729AF48ADULL, 0x2E18BC1AD9704A68ULL, 0x2DE0966DAF2F8B1CULL,
+    0xB9C11D5B1E43A07EULL, 0x64972D68DEE33360ULL, 0x94628D38D0C20584ULL, 0xDBC0D2B6AB90A559ULL,
+    0xD2733C4335C6A72FULL, 0x7E75D99D94A70F4DULL, 0x6CED1983376FA72BULL, 0x97FCAACBF030BC24ULL,
+    0x7B77497B32503B12ULL, 0x8547EDDFB81CCB94ULL, 0x79999CDFF70902CBULL, 0xCFFE1939438E9B24ULL,
+    0x829626E3892D95D7ULL, 0x92FAE24291F2B3F1ULL, 0x63E22C147B9C3403ULL, 0xC678B6D860284A1CULL,
+    0x5873888850659AE7ULL, 0x0981DCD296A8736DULL, 0x9F65789A6509A440ULL, 0x9FF38FED72E9052FULL,
+    0xE479EE5B9930578CULL, 0xE7F28ECD2D49EECDULL, 0x56C074A581EA17FEULL, 0x5544F7D774B14AEFULL,
+    0x7B3F0195FC6F290FULL, 0x12153635B2C0CF57ULL, 0x7F5126DBBA5E0CA7ULL, 0x7A76956C3EAFB413ULL,
+    0x3D5774A11D31AB39ULL, 0x8A1B083821F40CB4ULL, 0x7B4A38E32537DF62ULL, 0x950113646D1D6E03ULL,
+    0x4DA8979A0041E8A9ULL, 0x3BC36E078F7515D7ULL, 0x5D0A12F27AD310D1ULL, 0x7F9D1A2E1EBE1327ULL,
+    0xDA3A361B1C5157B1ULL, 0xDCDD7D20903D0C25ULL, 0x36833336D068F707ULL, 0xCE68341F79893389ULL,
+    0xAB9090168DD05F34ULL, 0x43954B3252DC25E5ULL, 0xB438C2B67F98E5E9ULL, 0x10DCD78E3851A492ULL,
+    0xDBC27AB5447822BFULL, 0x9B3CDB65F82CA382ULL, 0xB67B7896167B4C84ULL, 0xBFCED1B0048EAC50ULL,
+    0xA9119B60369FFEBDULL, 0x1FFF7AC80904BF45ULL, 0xAC12FB171817EEE7ULL, 0xAF08DA9177DDA93DULL,
+    0x1B0CAB936E65C744ULL, 0xB559EB1D04E5E932ULL, 0xC37B45B3F8D6F2BAULL, 0xC3A9DC228CAAC9E9ULL,
+    0xF3B8B6675A6507FFULL, 0x9FC477DE4ED681DAULL, 0x67378D8ECCEF96CBULL, 0x6DD856D94D259236ULL,
+    0xA319CE15B0B4DB31ULL, 0x073973751F12DD5EULL, 0x8A8E849EB32781A5ULL, 0xE1925C71285279F5ULL,
+    0x74C04BF1790C0EFEULL, 0x4DDA48153C94938AULL, 0x9D266D6A1CC0542CULL, 0x7440FB816508C4FEULL,
+    0x13328503DF48229FULL, 0xD6BF7BAEE43CAC40ULL, 0x4838D65F6EF6748FULL, 0x1E152328F3318DEAULL,
+    0x8F8419A348F296BFULL, 0x72C8834A5957B511ULL, 0xD7A023A73260B45CULL, 0x94EBC8ABCFB56DAEULL,
+    0x9FC10D0F989993E0ULL, 0xDE68A2355B93CAE6ULL, 0xA44CFE79AE538BBEULL, 0x9D1D84FCCE371425ULL,
+    0x51D2B1AB2DDFB636ULL, 0x2FD7E4B9E72CD38CULL, 0x65CA5B96B7552210ULL, 0xDD69A0D8AB3B546DULL,
+    0x604D51B25FBF70E2ULL, 0x73AA8A564FB7AC9EULL, 0x1A8C1E992B941148ULL, 0xAAC40A2703D9BEA0ULL,
+    0x764DBEAE7FA4F3A6ULL, 0x1E99B96E70A9BE8BULL, 0x2C5E9DEB57EF4743ULL, 0x3A938FEE32D29981ULL,
+    0x26E6DB8FFDF5ADFEULL, 0x469356C504EC9F9DULL, 0xC8763C5B08D1908CULL, 0x3F6C6AF859D80055ULL,
+    0x7F7CC39420A3A545ULL, 0x9BFB227EBDF4C5CEULL, 0x89039D79D6FC5C5CULL, 0x8FE88B57305E2AB6ULL,
+    0xA09E8C8C35AB96DEULL, 0xFA7E393983325753ULL, 0xD6B6D0ECC617C699ULL, 0xDFEA21EA9E7557E3ULL,
+    0xB67C1FA481680AF8ULL, 0xCA1E3785A9E724E5ULL, 0x1CFC8BED0D681639ULL, 0xD18D8549D140CAEAULL,
+    0x4ED0FE7E9DC91335ULL, 0xE4DBF0634473F5D2ULL, 0x1761F93A44D5AEFEULL, 0x53898E4C3910DA55ULL,
+    0x734DE8181F6EC39AULL, 0x2680B122BAA28D97ULL, 0x298AF231C85BAFABULL, 0x7983EED3740847D5ULL,
+    0x66C1A2A1A60CD889ULL, 0x9E17E49642A3E4C1ULL, 0xEDB454E7BADC0805ULL, 0x50B704CAB602C329ULL,
+    0x4CC317FB9CDDD023ULL, 0x66B4835D9EAFEA22ULL, 0x219B97E26FFC81BDULL, 0x261E4E4C0A333A9DULL,
+    0x1FE2CCA76517DB90ULL, 0xD7504DFA8816EDBBULL, 0xB9571FA04DC089C8ULL, 0x1DDC0325259B27DEULL,
+    0xCF3F4688801EB9AAULL, 0xF4F5D05C10CAB243ULL, 0x38B6525C21A42B0EULL, 0x36F60E2BA4FA6800ULL,
+    0xEB3593803173E0CEULL, 0x9C4CD6257C5A3603ULL, 0xAF0C317D32ADAA8AULL, 0x258E5A80C7204C4BULL,
+    0x8B889D624D44885DULL, 0xF4D14597E660F855ULL, 0xD4347F66EC8941C3ULL, 0xE699ED85B0DFB40DULL,
+    0x2472F6207C2D0484ULL, 0xC2A1E7B5B459AEB5ULL, 0xAB4F6451CC1D45ECULL, 0x63767572AE3D6174ULL,
+    0xA59E0BD101731A28ULL, 0x116D0016CB948F09ULL, 0x2CF9C8CA052F6E9FULL, 0x0B090A7560A968E3ULL,
+    0xABEEDDB2DDE06FF1ULL, 0x58EFC10B06A2068DULL, 0xC6E57A78FBD986E0ULL, 0x2EAB8CA63CE802D7ULL,
+    0x14A195640116F336ULL, 0x7C0828DD624EC390ULL, 0xD74BBE77E6116AC7ULL, 0x804456AF10F5FB53ULL,
+    0xEBE9EA2ADF4321C7ULL, 0x03219A39EE587A30ULL, 0x49787FEF17AF9924ULL, 0xA1E9300CD8520548ULL,
+    0x5B45E522E4B1B4EFULL, 0xB49C3B3995091A36ULL, 0xD4490AD526F14431ULL, 0x12A8F216AF9418C2ULL,
+    0x001F837CC7350524ULL, 0x1877B51E57A764D5ULL, 0xA2853B80F17F58EEULL, 0x993E1DE72D36D310ULL,
+    0xB3598080CE64A656ULL, 0x252F59CF0D9F04BBULL, 0xD23C8E176D113600ULL, 0x1BDA0492E7E4586EULL,
+    0x21E0BD5026C619BFULL, 0x3B097ADAF088F94EULL, 0x8D14DEDB30BE846EULL, 0xF95CFFA23AF5F6F4ULL,
+    0x3871700761B3F743ULL, 0xCA672B91E9E4FA16ULL, 0x64C8E531BFF53B55ULL, 0x241260ED4AD1E87DULL,
+    0x106C09B972D2E822ULL, 0x7FBA195410E5CA30ULL, 0x7884D9BC6CB569D8ULL, 0x0647DFEDCD894A29ULL,
+    0x63573FF03E224774ULL, 0x4FC8E9560F91B123ULL, 0x1DB956E450275779ULL, 0xB8D91274B9E9D4FBULL,
+    0xA2EBEE47E2FBFCE1ULL, 0xD9F1F30CCD97FB09ULL, 0xEFED53D75FD64E6BULL, 0x2E6D02C36017F67FULL,
+    0xA9AA4D20DB084E9BULL, 0xB64BE8D8B25396C1ULL, 0x70CB6AF7C2D5BCF0ULL, 0x98F076A4F7A2322EULL,
+    0xBF84470805E69B5FULL, 0x94C3251F06F90CF3ULL, 0x3E003E616A6591E9ULL, 0xB925A6CD0421AFF3ULL,
+    0x61BDD1307C66E300ULL, 0xBF8D5108E27E0D48ULL, 0x240AB57A8B888B20ULL, 0xFC87614BAF287E07ULL,
+    0xEF02CDD06FFDB432ULL, 0xA1082C0466DF6C0AULL, 0x8215E577001332C8ULL, 0xD39BB9C3A48DB6CFULL,
+    0x2738259634305C14ULL, 0x61CF4F94C97DF93DULL, 0x1B6BACA2AE4E125BULL, 0x758F450C88572E0BULL,
+    0x959F587D507A8359ULL, 0xB063E962E045F54DULL, 0x60E8ED72C0DFF5D1ULL, 0x7B64978555326F9FULL,
+    0xFD080D236DA814BAULL, 0x8C90FD9B083F4558ULL, 0x106F72FE81E2C590ULL, 0x7976033A39F7D952ULL,
+    0xA4EC0132764CA04BULL, 0x733EA705FAE4FA77ULL, 0xB4D8F77BC3E56167ULL, 0x9E21F4F903B33FD9ULL,
+    0x9D765E419FB69F6DULL, 0xD30C088BA61EA5EFULL, 0x5D94337FBFAF7F5BULL, 0x1A4E4822EB4D7A59ULL,
+    0x6FFE73E81B637FB3ULL, 0xDDF957BC36D8B9CAULL, 0x64D0E29EEA8838B3ULL, 0x08DD9BDFD96B9F63ULL,
+    0x087E79E5A57D1D13ULL, 0xE328E230E3E2B3FBULL, 0x1C2559E30F0946BEULL, 0x720BF5F26F4D2EAAULL,
+    0xB0774D261CC609DBULL, 0x443F64EC5A371195ULL, 0x4112CF68649A260EULL, 0xD813F2FAB7F5C5CAULL,
+    0x660D3257380841EEULL, 0x59AC2C7873F910A3ULL, 0xE846963877671A17ULL, 0x93B633ABFA3469F8ULL,
+    0xC0C0F5A60EF4CDCFULL, 0xCAF21ECD4377B28CULL, 0x57277707199B8175ULL, 0x506C11B9D90E8B1DULL,
+    0xD83CC2687A19255FULL, 0x4A29C6465A314CD1ULL, 0xED2DF21216235097ULL, 0xB5635C95FF7296E2ULL,
+    0x22AF003AB672E811ULL, 0x52E762596BF68235ULL, 0x9AEBA33AC6ECC6B0ULL, 0x944F6DE09134DFB6ULL,
+    0x6C47BEC883A7DE39ULL, 0x6AD047C430A12104ULL, 0xA5B1CFDBA0AB4067ULL, 0x7C45D833AFF07862ULL,
+    0x5092EF950A16DA0BULL, 0x9338E69C052B8E7BULL, 0x455A4B4CFE30E3F5ULL, 0x6B02E63195AD0CF8ULL,
+    0x6B17B224BAD6BF27ULL, 0xD1E0CCD25BB9C169ULL, 0xDE0C89A556B9AE70ULL, 0x50065E535A213CF6ULL,
+    0x9C1169FA2777B874ULL, 0x78EDEFD694AF1EEDULL, 0x6DC93D9526A50E68ULL, 0xEE97F453F06791EDULL,
+    0x32AB0EDB696703D3ULL, 0x3A6853C7E70757A7ULL, 0x31865CED6120F37DULL, 0x67FEF95D92607890ULL,
+    0x1F2B1D1F15F6DC9CULL, 0xB69E38A8965C6B65ULL, 0xAA9119FF184CCCF4ULL, 0xF43C732873F24C13ULL,
+    0xFB4A3D794A9A80D2ULL, 0x3550C2321FD6109CULL, 0x371F77E76BB8417EULL, 0x6BFA9AAE5EC05779ULL,
+    0xCD04F3FF001A4778ULL, 0xE3273522064480CAULL, 0x9F91508BFFCFC14AULL, 0x049A7F41061A9E60ULL,
+    0xFCB6BE43A9F2FE9BULL, 0x08DE8A1C7797DA9BULL, 0x8F9887E6078735A1ULL, 0xB5B4071DBFC73A66ULL,
+    0x230E343DFBA08D33ULL, 0x43ED7F5A0FAE657DULL, 0x3A88A0FBBCB05C63ULL, 0x21874B8B4D2DBC4FULL,
+    0x1BDEA12E35F6A8C9ULL, 0x53C065C6C8E63528ULL, 0xE34A1D250E7A8D6BULL, 0xD6B04D3B7651DD7EULL,
+    0x5E90277E7CB39E2DULL, 0x2C046F22062DC67DULL, 0xB10BB459132D0A26ULL, 0x3FA9DDFB67E2F199ULL,
+    0x0E09B88E1914F7AFULL, 0x10E8B35AF3EEAB37ULL, 0x9EEDECA8E272B933ULL, 0xD4C718BC4AE8AE5FULL,
+    0x81536D601170FC20ULL, 0x91B534F885818A06ULL, 0xEC8177F83F900978ULL, 0x190E714FADA5156EULL,
+    0xB592BF39B0364963ULL, 0x89C350C893AE7DC1ULL, 0xAC042E70F8B383F2ULL, 0xB49B52E587A1EE60ULL,
+    0xFB152FE3FF26DA89ULL, 0x3E666E6F69AE2C15ULL, 0x3B544EBE544C19F9ULL, 0xE805A1E290CF2456ULL,
+    0x24B33C9D7ED25117ULL, 0xE74733427B72F0C1ULL, 0x0A804D18B7097475ULL, 0x57E3306D881EDB4FULL,
+    0x4AE7D6A36EB5DBCBULL, 0x2D8D5432157064C8ULL, 0xD1E649DE1E7F268BULL, 0x8A328A1CEDFE552CULL,
+    0x07A3AEC79624C7DAULL, 0x84547DDC3E203C94ULL, 0x990A98FD5071D263ULL, 0x1A4FF12616EEFC89ULL,
+    0xF6F7FD1431714200ULL, 0x30C05B1BA332F41CULL, 0x8D2636B81555A786ULL, 0x46C9FEB55D120902ULL,
+    0xCCEC0A73B49C9921ULL, 0x4E9D2827355FC492ULL, 0x19EBB029435DCB0FULL, 0x4659D2B743848A2CULL,
+    0x963EF2C96B33BE31ULL, 0x74F85198B05A2E7DULL, 0x5A0F544DD2B1FB18ULL, 0x03727073C2E134B1ULL,
+    0xC7F6AA2DE59AEA61ULL, 0x352787BAA0D7C22FULL, 0x9853EAB63B5E0B35ULL, 0xABBDCDD7ED5C0860ULL,
+    0xCF05DAF5AC8D77B0ULL, 0x49CAD48CEBF4A71EULL, 0x7A4C10EC2158C4A6ULL, 0xD9E92AA246BF719EULL,
+    0x13AE978D09FE5557ULL, 0x730499AF921549FFULL, 0x4E4B705B92903BA4ULL, 0xFF577222C14F0A3AULL,
+    0x55B6344CF97AAFAEULL, 0xB862225B055B6960ULL, 0xCAC09AFBDDD2CDB4ULL, 0xDAF8E9829FE96B5FULL,
+    0xB5FDFC5D3132C498ULL, 0x310CB380DB6F7503ULL, 0xE87FBB46217A360EULL, 0x2102AE466EBB1148ULL,
+    0xF8549E1A3AA5E00DULL, 0x07A69AFDCC42261AULL, 0xC4C118BFE78FEAAEULL, 0xF9F4892ED96BD438ULL,
+    0x1AF3DBE25D8F45DAULL, 0xF5B4B0B0D2DEEEB4ULL, 0x962ACEEFA82E1C84ULL, 0x046E3ECAAF453CE9ULL,
+    0xF05D129681949A4CULL, 0x964781CE734B3C84ULL, 0x9C2ED44081CE5FBDULL, 0x522E23F3925E319EULL,
+    0x177E00F9FC32F791ULL, 0x2BC60A63A6F3B3F2ULL, 0x222BBFAE61725606ULL, 0x486289DDCC3D6780ULL,
+    0x7DC7785B8EFDFC80ULL, 0x8AF38731C02BA980ULL, 0x1FAB64EA29A2DDF7ULL, 0xE4D9429322CD065AULL,
+    0x9DA058C67844F20CULL, 0x24C0E332B70019B0ULL, 0x233003B5A6CFE6ADULL, 0xD586BD01C5C217F6ULL,
+    0x5E5637885F29BC2BULL, 0x7EBA726D8C94094BULL, 0x0A56A5F0BFE39272ULL, 0xD79476A84EE20D06ULL,
+    0x9E4C1269BAA4BF37ULL, 0x17EFEE45B0DEE640ULL, 0x1D95B0A5FCF90BC6ULL, 0x93CBE0B699C2585DULL,
+    0x65FA4F227A2B6D79ULL, 0xD5F9E858292504D5ULL, 0xC2B5A03F71471A6FULL, 0x59300222B4561E00ULL,
+    0xCE2F8642CA0712DCULL, 0x7CA9723FBB2E8988ULL, 0x2785338347F2BA08ULL, 0xC61BB3A141E50E8CULL,
+    0x150F361DAB9DEC26ULL, 0x9F6A419D382595F4ULL, 0x64A53DC924FE7AC9ULL, 0x142DE49FFF7A7C3DULL,
+    0x0C335248857FA9E7ULL, 0x0A9C32D5EAE45305ULL, 0xE6C42178C4BBB92EULL, 0x71F1CE2490D20B07ULL,
+    0xF1BCC3D275AFE51AULL, 0xE728E8C83C334074ULL, 0x96FBF83A12884624ULL, 0x81A1549FD6573DA5ULL,
+    0x5FA7867CAF35E149ULL, 0x56986E2EF3ED091BULL, 0x917F1DD5F8886C61ULL, 0xD20D8C88C8FFE65FULL,
+    0x31D71DCE64B2C310ULL, 0xF165B587DF898190ULL, 0xA57E6339DD2CF3A0ULL, 0x1EF6E6DBB1961EC9ULL,
+    0x70CC73D90BC26E24ULL, 0xE21A6B35DF0C3AD7ULL, 0x003A93D8B2806962ULL, 0x1C99DED33CB890A1ULL,
+    0xCF3145DE0ADD4289ULL, 0xD0E4427A5514FB72ULL, 0x77C621CC9FB3A483ULL, 0x67A34DAC4356550BULL,
+    0xF8D626AAAF278509ULL
+};
+
+const int POLYGLOT_CASTLE = 768;
+const int POLYGLOT_EN_PASSANT = 772;
+const int POLYGLOT_TURN = 780;
+
+MappedFile book_file;
+bool own_book = false;
+std::mt19937_64 book_rng((unsigned long long)std::chrono::steady_clock::now().time_since_epoch().count());
+
+U64 polyglot_key(const Position& pos) {
+    U64 key = 0ULL;
+    for (int color = WHITE; color <= BLACK; color++) {
+        for (int piece = P; piece <= K; piece++) {
+            // Kinds alternate black/white; Polyglot squares count from a1
+            int kind = 2 * piece + (color == WHITE ? 1 : 0);
+            U64 bb = pos.pieces[color][piece];
+            while (bb) {
+                int sq = lsb_index(bb);
+                pop_bit(bb, sq);
+                key ^= polyglot_random[64 * kind + (sq ^ 56)];
+            }
+        }
+    }
+    
+    // Our castling bits are K=1, Q=2, k=4, q=8, the same order as Polyglot's
+    for (int i = 0; i < 4; i++) {
+        if (pos.castling_rights & (1 << i)) key ^= polyglot_random[POLYGLOT_CASTLE + i];
+    }
+    
+    // The en passant file only counts when a pawn can actually capture there
+    int us = pos.side_to_move;
+    int ep = pos.en_passant_square;
+    if (ep >= 0 && ep < 64 && (pawn_attacks[1 - us][ep] & pos.pieces[us][P])) {
+        key ^= polyglot_random[POLYGLOT_EN_PASSANT + ep % 8];
+    }
+    
+    if (us == WHITE) key ^= polyglot_random[POLYGLOT_TURN];
+    return key;
+}
+
+inline U64 read_big_endian(const unsigned char* p, int bytes) {
+    U64 value = 0ULL;
+    for (int i = 0; i < bytes; i++) value = (value << 8) | p[i];
+    return value;
+}
+
+bool book_open(const std::string& path) {
+    book_file.close();
+    if (path.empty() || path == "<empty>") return false;
+    return book_file.open(path) && book_file.size() >= 16;
+}
+
+// Weighted random book move for pos, or Move() when the position is not in
+// the book (or the stored move is not legal here)
+Move book_probe(Position& pos) {
+    if (!book_file.data()) return Move();
+    const unsigned char* data = book_file.data();
+    size_t count = book_file.size() / 16;
+    U64 key = polyglot_key(pos);
+    
+    // Lower bound on the key
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (read_big_endian(data + mid * 16, 8) < key) low = mid + 1;
+        else high = mid;
+    }
+    
+    std::vector<std::pair<int, int>> candidates;  // (raw move, weight)
+    int total_weight = 0;
+    for (size_t i = low; i < count && read_big_endian(data + i * 16, 8) == key; i++) {
+        int move = (int)read_big_endian(data + i * 16 + 8, 2);
+        int weight = (int)read_big_endian(data + i * 16 + 10, 2);
+        if (weight == 0) continue;
+        candidates.push_back({ move, weight });
+        total_weight += weight;
+    }
+    if (candidates.empty()) return Move();
+    
+    int pick = (int)(book_rng() % (U64)total_weight);
+    int raw = candidates.back().first;
+    for (const auto& c : candidates) {
+        if (pick < c.second) {
+            raw = c.first;
+            break;
+        }
+        pick -= c.second;
+    }
+    
+    // Polyglot move: to file/row in bits 0-5, from in bits 6-11 (rows from
+    // rank 1), promotion piece in bits 12-14 (1 = knight ... 4 = queen)
+    int to_file = raw & 7, to_row = (raw >> 3) & 7;
+    int from_file = (raw >> 6) & 7, from_row = (raw >> 9) & 7;
+    int promo = (raw >> 12) & 7;
+    int from = (7 - from_row) * 8 + from_file;
+    
+    // Castling is stored as the king capturing its own rook
+    if (get_bit(pos.pieces[pos.side_to_move][K], from) && from_file == 4 && (to_file == 0 || to_file == 7)) {
+        to_file = (to_file == 7) ? 6 : 2;
+    }
+    
+    std::string uci;
+    uci += (char)('a' + from_file);
+    uci += (char)('1' + from_row);
+    uci += (char)('a' + to_file);
+    uci += (char)('1' + to_row);
+    if (promo >= 1 && promo <= 4) uci += " nbrq"[promo];
+    return parse_move(pos, uci);
+}
+
 // ========================================
 // 14. UCI Protocol Implementation
 // ========================================
@@ -3664,6 +5240,54 @@ void parse_fen(Position& pos, const std::string& fen) {
     }
     
     pos.hash_key = generate_hash_key(pos);
+    pos.pawn_key = generate_pawn_key(pos);
+    refresh_psq_score(pos);
+}
+
+// Inverse of parse_fen; the move counters are supplied by the caller
+std::string position_to_fen(const Position& pos, int halfmove = 0, int fullmove = 1) {
+    const char piece_chars[2][7] = { "PNBRQK", "pnbrqk" };
+    std::string fen;
+    for (int rank = 0; rank < 8; rank++) {
+        int empty = 0;
+        for (int file = 0; file < 8; file++) {
+            int square = rank * 8 + file;
+            char c = 0;
+            for (int color = WHITE; color <= BLACK && !c; color++) {
+                for (int piece = P; piece <= K; piece++) {
+                    if (get_bit(pos.pieces[color][piece], square)) {
+                        c = piece_chars[color][piece];
+                        break;
+                    }
+                }
+            }
+            if (!c) {
+                empty++;
+                continue;
+            }
+            if (empty) fen += (char)('0' + empty);
+            empty = 0;
+            fen += c;
+        }
+        if (empty) fen += (char)('0' + empty);
+        if (rank < 7) fen += '/';
+    }
+    
+    fen += (pos.side_to_move == WHITE) ? " w " : " b ";
+    if (pos.castling_rights & 1) fen += 'K';
+    if (pos.castling_rights & 2) fen += 'Q';
+    if (pos.castling_rights & 4) fen += 'k';
+    if (pos.castling_rights & 8) fen += 'q';
+    if (!pos.castling_rights) fen += '-';
+    
+    fen += ' ';
+    if (pos.en_passant_square >= 0 && pos.en_passant_square < 64) {
+        fen += (char)('a' + pos.en_passant_square % 8);
+        fen += (char)('8' - pos.en_passant_square / 8);
+    } else {
+        fen += '-';
+    }
+    return fen + " " + std::to_string(halfmove) + " " + std::to_string(fullmove);
 }
 
 // Move Parsing and UCI Integration
@@ -3708,6 +5332,118 @@ Move parse_move(Position& pos, const std::string& move_str) {
     return Move();
 }
 
+// Standard algebraic notation ("Nbxd2", "exd6", "e8=Q+", "O-O"). The moving
+// piece is found from the attack tables of the target square rather than by
+// generating the legal move list; pinned candidates are discarded, which is
+// all SAN disambiguation needs. Returns Move() if no piece or more than one
+// can make the move. A king left in check by an en passant capture is not
+// detected here.
+Move parse_san(const Position& pos, std::string san) {
+    while (!san.empty() && strchr("+#!?", san.back())) san.pop_back();
+    int us = pos.side_to_move;
+    int them = 1 - us;
+    int king_sq = lsb_index(pos.pieces[us][K]);
+    if (king_sq < 0) return Move();
+    
+    if (san == "O-O" || san == "0-0" || san == "O-O-O" || san == "0-0-0") {
+        bool long_castle = san.size() == 5;
+        int from = (us == WHITE) ? e1 : e8;
+        int to = (us == WHITE) ? (long_castle ? c1 : g1) : (long_castle ? c8 : g8);
+        if (king_sq != from) return Move();
+        
+        // Empty path, not out of or through check: same test as the generator
+        MoveList castles;
+        generate_castling_moves(pos, castles, us);
+        for (const Move& move : castles.moves) {
+            if (move.get_to() == to) return move;
+        }
+        return Move();
+    }
+    
+    int piece = P;
+    size_t index = 0;
+    if (!san.empty() && strchr("NBRQK", san[0])) {
+        piece = (int)(strchr("PNBRQK", san[0]) - "PNBRQK");
+        index = 1;
+    }
+    
+    int promo = 0;
+    size_t eq = san.find('=');
+    if (eq != std::string::npos || (piece == P && !san.empty() && strchr("NBRQ", san.back()))) {
+        char c = (eq != std::string::npos && eq + 1 < san.size()) ? san[eq + 1] : san.back();
+        if (!strchr("NBRQ", c)) return Move();
+        promo = (int)(strchr("PNBRQK", c) - "PNBRQK");
+        san.erase(eq != std::string::npos ? eq : san.size() - 1);
+    }
+    if (san.size() < index + 2) return Move();
+    
+    // Target square is the last two characters; anything between the piece
+    // letter and the target is disambiguation or the capture mark
+    char to_file = san[san.size() - 2], to_rank = san[san.size() - 1];
+    if (to_file < 'a' || to_file > 'h' || to_rank < '1' || to_rank > '8') return Move();
+    int to = ('8' - to_rank) * 8 + (to_file - 'a');
+    int from_file = -1, from_rank = -1;
+    for (size_t i = index; i < san.size() - 2; i++) {
+        char c = san[i];
+        if (c >= 'a' && c <= 'h') from_file = c - 'a';
+        else if (c >= '1' && c <= '8') from_rank = '8' - c;
+        else if (c != 'x' && c != '-') return Move();
+    }
+    if (get_bit(pos.occupancies[us], to)) return Move();
+    bool capture = get_bit(pos.occupancies[them], to) != 0;
+    
+    U64 candidates = 0ULL;
+    bool enpassant = false, double_push = false;
+    if (piece == P) {
+        int forward = (us == WHITE) ? -8 : 8;  // a8 = 0, so White moves to lower squares
+        if (from_file >= 0 && from_file != to % 8) {
+            // Capture: the pawn stands diagonally behind the target square
+            enpassant = (to == pos.en_passant_square) && !capture;
+            if (!capture && !enpassant) return Move();
+            capture = true;
+            candidates = pawn_attacks[them][to] & pos.pieces[us][P];
+        } else {
+            if (capture) return Move();
+            int from = to - forward;
+            if (from < 0 || from > 63) return Move();
+            if (get_bit(pos.pieces[us][P], from)) {
+                set_bit(candidates, from);
+            } else if (!get_bit(pos.occupancies[2], from) && from - forward >= 0 && from - forward < 64 &&
+                       get_bit(pos.pieces[us][P], from - forward) && (to / 8 == ((us == WHITE) ? 4 : 3))) {
+                set_bit(candidates, from - forward);
+                double_push = true;
+            }
+        }
+        bool last_rank = (us == WHITE) ? (to / 8 == 0) : (to / 8 == 7);
+        if (last_rank != (promo != 0)) return Move();
+    } else {
+        if (promo) return Move();
+        U64 occ = pos.occupancies[2];
+        switch (piece) {
+            case N: candidates = knight_attacks[to]; break;
+            case B: candidates = get_bishop_attacks(to, occ); break;
+            case R: candidates = get_rook_attacks(to, occ); break;
+            case Q: candidates = get_queen_attacks(to, occ); break;
+            case K: candidates = king_attacks[to]; break;
+        }
+        candidates &= pos.pieces[us][piece];
+    }
+    
+    if (from_file >= 0) candidates &= file_masks[from_file];
+    if (from_rank >= 0) candidates &= rank_masks[from_rank];
+    U64 pinned = pinned_pieces(pos, us, king_sq);
+    U64 legal = 0ULL;
+    while (candidates) {
+        int from = lsb_index(candidates);
+        pop_bit(candidates, from);
+        if (get_bit(pinned, from) && !get_bit(line_squares[king_sq][from], to)) continue;
+        set_bit(legal, from);
+    }
+    if (count_bits(legal) != 1) return Move();
+    
+    return Move(lsb_index(legal), to, piece, promo, capture, double_push, enpassant, false);
+}
+
 std::string move_to_string(const Move& move) {
     std::string result;
     
@@ -3748,36 +5484,119 @@ void print_move_list(const MoveList& move_list) {
 }
 
 // UCI command handling (FIXED)
+// stdin is read on its own thread so that "stop" and "quit" reach a running
+// search; the commands themselves still run in order on the UCI thread, which
+// owns the thread_local search state
+struct UciInput {
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::string> lines;
+    std::atomic<int> go_count{0};    // "go" commands read so far
+    std::atomic<int> stopped_go{0};  // the last "go" a stop applies to
+};
+
+void uci_read_input(UciInput& input) {
+    std::string line;
+    while (true) {
+        if (!std::getline(std::cin, line)) line = "quit";
+        if (line.substr(0, 2) == "go") input.go_count++;
+        if (line == "stop" || line == "quit") {
+            input.stopped_go.store(input.go_count.load());
+            stop_search.store(true);
+        }
+        {
+            std::lock_guard<std::mutex> lock(input.mutex);
+            input.lines.push_back(line);
+        }
+        input.ready.notify_one();
+        if (line == "quit") break;
+    }
+}
+
 void uci_loop() {
     std::string command;
     Position current_pos;
     setup_starting_position(current_pos); // Initialize with starting position
-    
-    while (std::getline(std::cin, command)) {
+    reset_key_stack(current_pos.hash_key);
+    
+    UciInput input;
+    std::thread reader(uci_read_input, std::ref(input));
+    int go_index = 0;
+    
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(input.mutex);
+            input.ready.wait(lock, [&]() { return !input.lines.empty(); });
+            command = input.lines.front();
+            input.lines.pop_front();
+        }
+        
         if (command == "uci") {
             std::cout << "id name Douchess" << std::endl;
             std::cout << "id author changcheng967" << std::endl;
+            std::cout << "option name EvalFile type string default <empty>" << std::endl;
+            std::cout << "option name MaterialEvalThreshold type spin default 1000 min 0 max 10000" << std::endl;
+            std::cout << "option name OwnBook type check default false" << std::endl;
+            std::cout << "option name BookFile type string default <empty>" << std::endl;
+            for (const TunableParam& tp : tunable_params) {
+                std::cout << "option name " << tp.name << " type spin default " << search_params.*tp.field
+                          << " min " << tp.min << " max " << tp.max << std::endl;
+            }
             std::cout << "uciok" << std::endl;
         }
         else if (command == "isready") {
             std::cout << "readyok" << std::endl;
         }
+        else if (command.substr(0, 9) == "setoption") {
+            // setoption name <id> [value <x>]; option values may contain spaces
+            size_t name_pos = command.find(" name ");
+            size_t value_pos = command.find(" value ");
+            if (name_pos != std::string::npos) {
+                std::string name = command.substr(name_pos + 6, value_pos == std::string::npos
+                                                              ? std::string::npos : value_pos - name_pos - 6);
+                std::string value = (value_pos == std::string::npos) ? "" : command.substr(value_pos + 7);
+                
+                if (name == "EvalFile") {
+                    if (nnue_init(value)) {
+                        std::cout << "info string NNUE evaluation using " << (eval_file.empty() || eval_file == "<empty>" ? "embedded network" : eval_file) << std::endl;
+                    } else if (value.empty() || value == "<empty>") {
+                        std::cout << "info string Using handcrafted evaluation" << std::endl;
+                    } else {
+                        std::cout << "info string Failed to load network " << value << ", using handcrafted evaluation" << std::endl;
+                    }
+                } else if (name == "OwnBook") {
+                    own_book = (value == "true");
+                } else if (name == "BookFile") {
+                    if (book_open(value)) {
+                        std::cout << "info string Book " << value << " loaded, " << book_file.size() / 16 << " entries" << std::endl;
+                    } else if (!value.empty() && value != "<empty>") {
+                        std::cout << "info string Failed to load book " << value << std::endl;
+                    }
+                } else if (name == "MaterialEvalThreshold") {
+                    material_eval_threshold = std::max(0, std::min(atoi(value.c_str()), 10000));
+                } else if (set_search_param(search_params, name, atoi(value.c_str()))) {
+                    // Search tunable; LMR table is rebuilt on the next search if needed
+                } else {
+                    std::cout << "info string Unknown option " << name << std::endl;
+                }
+            }
+        }
         else if (command == "ucinewgame") {
             clear_tt();
             clear_history();
-            position_history.clear();  // ADD THIS!
-            halfmove_clock = 0;         // ADD THIS!
+            halfmove_clock = 0;
             setup_starting_position(current_pos);
+            reset_key_stack(current_pos.hash_key);
             // ADD: Verify TT is actually cleared
             std::cout << "info string TT cleared, " << TT_SIZE << " entries reset" << std::endl;
         }
         else if (command.substr(0, 8) == "position") {
             // ✅ CLEAR HISTORY WHEN SETTING NEW POSITION!
-            position_history.clear();
             halfmove_clock = 0;
             
             if (command.find("startpos") != std::string::npos) {
                 setup_starting_position(current_pos);
+                reset_key_stack(current_pos.hash_key);
                 std::cout << "info string Position set to startpos" << std::endl;
                 
                 // Handle moves after startpos
@@ -3808,6 +5627,7 @@ void uci_loop() {
                     fen = command.substr(fen_start);
                 }
                 parse_fen(current_pos, fen);
+                reset_key_stack(current_pos.hash_key);
                 std::cout << "info string Position set from FEN" << std::endl;
                 
                 // Handle moves after FEN
@@ -3832,9 +5652,18 @@ void uci_loop() {
             std::string token;
             iss >> token; // Skip "go"
             
+            // Clear the stop flag unless a "stop" for this very go was already read
+            go_index++;
+            stop_search.store(false);
+            if (input.stopped_go.load() >= go_index) stop_search.store(true);
+            bool infinite = false;
+            
             // Phase 4: Adaptive Time Management
             int wtime = 0, btime = 0, winc = 0, binc = 0;
             int movestogo = 40;
+            long long movetime = 0;
+            node_limit = 0;
+            depth_limit = MAX_DEPTH;
             
             // Parse time control parameters
             while (iss >> token) {
@@ -3848,6 +5677,16 @@ void uci_loop() {
                     iss >> binc;
                 } else if (token == "movestogo") {
                     iss >> movestogo;
+                } else if (token == "movetime") {
+                    iss >> movetime;
+                } else if (token == "nodes") {
+                    iss >> node_limit;
+                } else if (token == "depth") {
+                    iss >> depth_limit;
+                    depth_limit = std::max(1, std::min(depth_limit, MAX_DEPTH));
+                } else if (token == "infinite") {
+                    movetime = 1LL << 40;  // runs until "stop"
+                    infinite = true;
                 }
             }
             
@@ -3856,14 +5695,29 @@ void uci_loop() {
             int increment = (current_pos.side_to_move == WHITE) ? winc : binc;
             
             // FIX: Only use adaptive time if time controls are provided
-            if (time_left > 0 || increment > 0) {
+            if (movetime > 0) {
+                time_limit = movetime;
+            } else if (node_limit > 0 || depth_limit < MAX_DEPTH) {
+                time_limit = 1LL << 40;  // the node/depth limit ends the search
+            } else if (time_left > 0 || increment > 0) {
                 time_limit = calculate_time_for_move(time_left, increment, movestogo);
                 if (time_limit > 2000) time_limit = 2000;
             } else {
                 time_limit = 2000;  // Default to 2 seconds
             }
             
-            Move best = search_position(current_pos);
+            // Book moves are played instantly, without a search
+            Move best = own_book ? book_probe(current_pos) : Move();
+            if (best.move != 0) {
+                std::cout << "info string book move" << std::endl;
+            } else {
+                best = search_position(current_pos);
+            }
+            
+            // The bestmove of an infinite search is only sent after "stop"
+            while (infinite && !stop_search.load()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
             
             if (best.move != 0) {
                 std::cout << "bestmove ";
@@ -3884,21 +5738,2084 @@ void uci_loop() {
         else if (command == "quit") {
             break;
         }
+        else if (command == "stop") {
+            // Handled by the input thread, which sets stop_search
+        }
         else if (command == "d" || command == "display") {
             // Display current position (for debugging)
             std::cout << "info string Current position hash: " << current_pos.hash_key << std::endl;
         }
     }
+    
+    reader.join();
 }
 
 // ========================================
-// 15. Main Function
+// 15. Training Data, NNUE Trainer and Texel Tuner
 // ========================================
-int main() {
-    // Initialize all systems
-    init_zobrist_keys();
-    init_attack_tables();
-    clear_tt(); // Initialize TT
+
+// 32-byte training record. The occupied squares are listed in square order
+// (a8 first) as 4-bit codes color * 6 + piece, two per byte, low nibble first.
+struct PackedPosition {
+    U64 occupancy;
+    uint8_t pieces[16];
+    int16_t score;            // search score, White's perspective, centipawns
+    uint8_t result;           // 0 = Black won, 1 = draw, 2 = White won
+    uint8_t side_to_move;
+    uint8_t en_passant;       // square, or 64 for none
+    uint8_t castling;
+    uint16_t halfmove_clock;
+};
+static_assert(sizeof(PackedPosition) == 32, "PackedPosition must stay 32 bytes");
+
+bool pack_position(const Position& pos, int score, int result, int halfmove, PackedPosition& packed) {
+    memset(&packed, 0, sizeof(packed));
+    if (count_bits(pos.occupancies[2]) > 32) return false;
+    
+    packed.occupancy = pos.occupancies[2];
+    int index = 0;
+    U64 occ = pos.occupancies[2];
+    while (occ) {
+        int sq = lsb_index(occ);
+        pop_bit(occ, sq);
+        int code = 0;
+        for (int color = 0; color < 2; color++) {
+            for (int piece = 0; piece < 6; piece++) {
+                if (get_bit(pos.pieces[color][piece], sq)) code = color * 6 + piece;
+            }
+        }
+        packed.pieces[index / 2] |= (uint8_t)(code << ((index & 1) * 4));
+        index++;
+    }
+    
+    packed.score = (int16_t)std::max(-32767, std::min(score, 32767));
+    packed.result = (uint8_t)result;
+    packed.side_to_move = (uint8_t)pos.side_to_move;
+    packed.en_passant = (uint8_t)(pos.en_passant_square < 0 ? 64 : pos.en_passant_square);
+    packed.castling = (uint8_t)pos.castling_rights;
+    packed.halfmove_clock = (uint16_t)std::min(halfmove, 65535);
+    return true;
+}
+
+// Returns false for records that cannot be a chess position
+bool unpack_position(const PackedPosition& packed, Position& pos) {
+    pos = Position();
+    int index = 0;
+    U64 occ = packed.occupancy;
+    while (occ) {
+        int sq = lsb_index(occ);
+        pop_bit(occ, sq);
+        int code = (packed.pieces[index / 2] >> ((index & 1) * 4)) & 15;
+        if (code >= 12 || index >= 32) return false;
+        int color = code / 6;
+        set_bit(pos.pieces[color][code % 6], sq);
+        set_bit(pos.occupancies[color], sq);
+        set_bit(pos.occupancies[2], sq);
+        index++;
+    }
+    if (count_bits(pos.pieces[WHITE][K]) != 1 || count_bits(pos.pieces[BLACK][K]) != 1) return false;
+    if (packed.side_to_move > 1 || packed.result > 2 || packed.castling > 15) return false;
+    
+    pos.side_to_move = packed.side_to_move;
+    pos.en_passant_square = (packed.en_passant < 64) ? packed.en_passant : -1;
+    pos.castling_rights = packed.castling;
+    pos.hash_key = generate_hash_key(pos);
+    pos.pawn_key = generate_pawn_key(pos);
+    refresh_psq_score(pos);
+    return true;
+}
+
+// Read-only, random-access view of a file of PackedPosition records. The
+// file is memory mapped, so opening is free and records are paged in on use;
+// records are copied out because the mapping carries no alignment promise.
+class PackedPositionFile {
+public:
+    bool open(const std::string& path) {
+        return file.open(path) && file.size() >= sizeof(PackedPosition);
+    }
+    
+    size_t size() const { return file.size() / sizeof(PackedPosition); }
+    
+    PackedPosition operator[](size_t index) const {
+        PackedPosition rec;
+        memcpy(&rec, file.data() + index * sizeof(PackedPosition), sizeof(rec));
+        return rec;
+    }
+    
+private:
+    MappedFile file;
+};
+
+// "--name value" lookup for the tool subcommands
+std::string arg_value(const std::vector<std::string>& args, const std::string& name, const std::string& fallback) {
+    for (size_t i = 0; i + 1 < args.size(); i++) {
+        if (args[i] == name) return args[i + 1];
+    }
+    return fallback;
+}
+
+int default_tool_threads() {
+    return std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+// Float copy of the network, all parameters in one vector so the optimizer
+// is a single loop: [ft_weights | ft_bias | out_weights | out_bias]
+const size_t TRAIN_FT_WEIGHTS = 0;
+const size_t TRAIN_FT_BIAS = (size_t)NNUE_INPUTS * NNUE_HIDDEN;
+const size_t TRAIN_OUT_WEIGHTS = TRAIN_FT_BIAS + NNUE_HIDDEN;
+const size_t TRAIN_OUT_BIAS = TRAIN_OUT_WEIGHTS + 2 * NNUE_HIDDEN;
+const size_t TRAIN_PARAMS = TRAIN_OUT_BIAS + 1;
+const double TRAIN_WDL_SCALE = 400.0;   // centipawns -> win probability
+const float TRAIN_WEIGHT_CLIP = 1.98f;  // keeps 32 features x QA inside int16
+
+struct TrainWorker {
+    std::vector<float> grad;        // same layout as the parameters
+    std::vector<uint8_t> touched;   // feature rows with a non-zero gradient
+    double loss = 0.0;
+    long long count = 0;
+};
+
+// The sparse first layer: 256-wide row add, the only O(features) work
+inline void train_add_row(float* dst, const float* src) {
+#if defined(NNUE_AVX2)
+    for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_loadu_ps(src + i)));
+    }
+#elif defined(NNUE_SSE)
+    for (int i = 0; i < NNUE_HIDDEN; i += 4) {
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_loadu_ps(src + i)));
+    }
+#else
+    for (int i = 0; i < NNUE_HIDDEN; i++) dst[i] += src[i];
+#endif
+}
+
+int extract_features(const Position& pos, int perspective, int* features) {
+    int bucket = nnue_bucket(lsb_index(pos.pieces[perspective][K]), perspective);
+    int count = 0;
+    for (int color = 0; color < 2; color++) {
+        for (int piece = 0; piece < 6; piece++) {
+            U64 bitboard = pos.pieces[color][piece];
+            while (bitboard) {
+                int sq = lsb_index(bitboard);
+                pop_bit(bitboard, sq);
+                features[count++] = nnue_feature(perspective, bucket, color, piece, sq);
+            }
+        }
+    }
+    return count;
+}
+
+// Forward pass, and backward into worker.grad when a worker is given.
+// Returns the squared error of the win probability.
+double train_sample(const std::vector<float>& params, const Position& pos, int white_score,
+                    int white_result, double lambda, TrainWorker* worker) {
+    alignas(32) float acc[2][NNUE_HIDDEN];
+    int features[2][32];
+    int counts[2];
+    int stm = pos.side_to_move;
+    const int persp[2] = { stm, 1 - stm };   // acc[0] is the side to move
+    
+    for (int h = 0; h < 2; h++) {
+        counts[h] = extract_features(pos, persp[h], features[h]);
+        memcpy(acc[h], &params[TRAIN_FT_BIAS], sizeof(float) * NNUE_HIDDEN);
+        for (int f = 0; f < counts[h]; f++) {
+            train_add_row(acc[h], &params[TRAIN_FT_WEIGHTS + (size_t)features[h][f] * NNUE_HIDDEN]);
+        }
+    }
+    
+    const float* out_w = &params[TRAIN_OUT_WEIGHTS];
+    double output = params[TRAIN_OUT_BIAS];
+    for (int h = 0; h < 2; h++) {
+        for (int i = 0; i < NNUE_HIDDEN; i++) {
+            output += std::max(0.0f, std::min(acc[h][i], 1.0f)) * out_w[h * NNUE_HIDDEN + i];
+        }
+    }
+    
+    double score = (stm == WHITE) ? white_score : -white_score;
+    double result = (stm == WHITE) ? white_result / 2.0 : 1.0 - white_result / 2.0;
+    double target = lambda / (1.0 + std::exp(-score / TRAIN_WDL_SCALE)) + (1.0 - lambda) * result;
+    double scale = NNUE_SCALE / TRAIN_WDL_SCALE;
+    double pred = 1.0 / (1.0 + std::exp(-output * scale));
+    double err = pred - target;
+    if (!worker) return err * err;
+    
+    float g = (float)(2.0 * err * pred * (1.0 - pred) * scale);
+    float* grad = worker->grad.data();
+    grad[TRAIN_OUT_BIAS] += g;
+    
+    alignas(32) float d_acc[NNUE_HIDDEN];
+    for (int h = 0; h < 2; h++) {
+        for (int i = 0; i < NNUE_HIDDEN; i++) {
+            float a = acc[h][i];
+            grad[TRAIN_OUT_WEIGHTS + h * NNUE_HIDDEN + i] += g * std::max(0.0f, std::min(a, 1.0f));
+            d_acc[i] = (a > 0.0f && a < 1.0f) ? g * out_w[h * NNUE_HIDDEN + i] : 0.0f;
+        }
+        train_add_row(&grad[TRAIN_FT_BIAS], d_acc);
+        for (int f = 0; f < counts[h]; f++) {
+            train_add_row(&grad[TRAIN_FT_WEIGHTS + (size_t)features[h][f] * NNUE_HIDDEN], d_acc);
+            worker->touched[features[h][f]] = 1;
+        }
+    }
+    
+    worker->loss += err * err;
+    worker->count++;
+    return err * err;
+}
+
+// Quantize to the format nnue_load_from_memory() reads
+std::vector<unsigned char> quantize_network(const std::vector<float>& params) {
+    std::vector<unsigned char> out(NNUE_FILE_SIZE);
+    uint32_t header[4] = { NNUE_MAGIC, NNUE_VERSION, (uint32_t)NNUE_HIDDEN, (uint32_t)NNUE_KING_BUCKETS };
+    memcpy(out.data(), header, sizeof(header));
+    
+    unsigned char* p = out.data() + NNUE_HEADER_SIZE;
+    auto put16 = [&](double v) {
+        int16_t q = (int16_t)std::max(-32767.0, std::min(std::round(v), 32767.0));
+        memcpy(p, &q, sizeof(q));
+        p += sizeof(q);
+    };
+    for (size_t i = 0; i < TRAIN_OUT_WEIGHTS; i++) put16(params[i] * NNUE_QA);   // ft weights + bias
+    for (int i = 0; i < 2 * NNUE_HIDDEN; i++) put16(params[TRAIN_OUT_WEIGHTS + i] * NNUE_QB);
+    int32_t bias = (int32_t)std::round(params[TRAIN_OUT_BIAS] * NNUE_QA * NNUE_QB);
+    memcpy(p, &bias, sizeof(bias));
+    return out;
+}
+
+bool write_network(const std::string& path, const std::vector<unsigned char>& net) {
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    bool ok = fwrite(net.data(), 1, net.size(), f) == net.size();
+    return (fclose(f) == 0) && ok;
+}
+
+// Byte list for DOUCHESS_EMBEDDED_NET builds
+bool write_network_inc(const std::string& path, const std::vector<unsigned char>& net) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) return false;
+    for (size_t i = 0; i < net.size(); i++) {
+        fprintf(f, "0x%02X,%s", net[i], (i % 16 == 15) ? "\n" : "");
+    }
+    fprintf(f, "\n");
+    return fclose(f) == 0;
+}
+
+// train <data.bin> [--out file] [--inc file] [--resume file] [--epochs n]
+//       [--batch n] [--lr x] [--lambda x] [--threads n]
+// Positions whose Zobrist key is 0 mod 64 are held out for validation, so a
+// position repeated across games never lands on both sides of the split.
+int run_train(const std::vector<std::string>& args) {
+    if (args.empty() || args[0].substr(0, 2) == "--") {
+        std::cerr << "usage: train <data.bin> [--out douchess.nnue] [--inc file] [--resume net]"
+                     " [--epochs 10] [--batch 16384] [--lr 0.001] [--lambda 0.75] [--threads n]" << std::endl;
+        return 1;
+    }
+    std::string out_path = arg_value(args, "--out", "douchess.nnue");
+    std::string inc_path = arg_value(args, "--inc", "");
+    std::string resume_path = arg_value(args, "--resume", "");
+    int epochs = std::stoi(arg_value(args, "--epochs", "10"));
+    int batch_size = std::max(1, std::stoi(arg_value(args, "--batch", "16384")));
+    double lr = std::stod(arg_value(args, "--lr", "0.001"));
+    double lambda = std::stod(arg_value(args, "--lambda", "0.75"));
+    int threads = std::max(1, std::stoi(arg_value(args, "--threads", std::to_string(default_tool_threads()))));
+    
+    PackedPositionFile data;
+    if (!data.open(args[0])) {
+        std::cerr << "cannot read " << args[0] << std::endl;
+        return 1;
+    }
+    size_t total = data.size();
+    
+    std::vector<float> params(TRAIN_PARAMS, 0.0f);
+    if (!resume_path.empty()) {
+        MappedFile net;
+        if (!net.open(resume_path) || !nnue_load_from_memory(net.data(), net.size())) {
+            std::cerr << "cannot load network " << resume_path << std::endl;
+            return 1;
+        }
+        for (size_t i = 0; i < TRAIN_FT_BIAS; i++) params[i] = nnue_net.ft_weights[i] / (float)NNUE_QA;
+        for (int i = 0; i < NNUE_HIDDEN; i++) params[TRAIN_FT_BIAS + i] = nnue_net.ft_bias[i] / (float)NNUE_QA;
+        for (int i = 0; i < 2 * NNUE_HIDDEN; i++) params[TRAIN_OUT_WEIGHTS + i] = nnue_net.out_weights[i] / (float)NNUE_QB;
+        params[TRAIN_OUT_BIAS] = nnue_net.out_bias / (float)(NNUE_QA * NNUE_QB);
+        nnue_net = NNUENetwork();
+    } else {
+        std::mt19937 rng(12345);
+        std::uniform_real_distribution<float> ft_init(-0.1f, 0.1f);
+        std::uniform_real_distribution<float> out_init(-0.05f, 0.05f);
+        for (size_t i = 0; i < TRAIN_FT_BIAS; i++) params[i] = ft_init(rng);
+        for (int i = 0; i < 2 * NNUE_HIDDEN; i++) params[TRAIN_OUT_WEIGHTS + i] = out_init(rng);
+    }
+    
+    std::vector<float> adam_m(TRAIN_PARAMS, 0.0f), adam_v(TRAIN_PARAMS, 0.0f);
+    std::vector<TrainWorker> workers(threads);
+    for (auto& w : workers) {
+        w.grad.assign(TRAIN_PARAMS, 0.0f);
+        w.touched.assign(NNUE_INPUTS, 0);
+    }
+    
+    std::cout << "training on " << total << " positions, " << threads << " threads, batch "
+              << batch_size << std::endl;
+    
+    const double beta1 = 0.9, beta2 = 0.999, eps = 1e-8;
+    long long step = 0;
+    
+    for (int epoch = 1; epoch <= epochs; epoch++) {
+        long long epoch_start = current_time_ms();
+        double epoch_loss = 0.0;
+        long long epoch_count = 0;
+        
+        for (size_t first = 0; first < total; first += batch_size) {
+            size_t last = std::min(total, first + (size_t)batch_size);
+            size_t per_thread = (last - first + threads - 1) / threads;
+            
+            // Forward/backward, each thread into its own gradient buffer
+            std::vector<std::thread> pool;
+            for (int t = 0; t < threads; t++) {
+                pool.emplace_back([&, t]() {
+                    TrainWorker& w = workers[t];
+                    size_t begin = first + t * per_thread;
+                    size_t end = std::min(last, begin + per_thread);
+                    for (size_t i = begin; i < end; i++) {
+                        PackedPosition rec = data[i];
+                        Position pos;
+                        if (!unpack_position(rec, pos) || pos.hash_key % 64 == 0) continue;
+                        train_sample(params, pos, rec.score, rec.result, lambda, &w);
+                    }
+                });
+            }
+            for (auto& th : pool) th.join();
+            
+            long long batch_count = 0;
+            for (auto& w : workers) {
+                batch_count += w.count;
+                epoch_loss += w.loss;
+                w.loss = 0.0;
+                w.count = 0;
+            }
+            if (batch_count == 0) continue;
+            epoch_count += batch_count;
+            step++;
+            
+            // Reduce and apply Adam, feature rows split across threads
+            double inv_batch = 1.0 / batch_count;
+            double lr_t = lr * std::sqrt(1.0 - std::pow(beta2, (double)step)) / (1.0 - std::pow(beta1, (double)step));
+            auto adam = [&](size_t begin, size_t end, bool sparse_rows) {
+                for (size_t i = begin; i < end; i++) {
+                    float g = 0.0f;
+                    for (auto& w : workers) {
+                        if (sparse_rows && !w.touched[i / NNUE_HIDDEN]) continue;
+                        g += w.grad[i];
+                        w.grad[i] = 0.0f;
+                    }
+                    g = (float)(g * inv_batch);
+                    adam_m[i] = (float)(beta1 * adam_m[i] + (1.0 - beta1) * g);
+                    adam_v[i] = (float)(beta2 * adam_v[i] + (1.0 - beta2) * g * g);
+                    float p = params[i] - (float)(lr_t * adam_m[i] / (std::sqrt(adam_v[i]) + eps));
+                    params[i] = (i < TRAIN_OUT_BIAS) ? std::max(-TRAIN_WEIGHT_CLIP, std::min(p, TRAIN_WEIGHT_CLIP)) : p;
+                }
+            };
+            pool.clear();
+            size_t rows_per_thread = (NNUE_INPUTS + threads - 1) / threads;
+            for (int t = 0; t < threads; t++) {
+                pool.emplace_back([&, t]() {
+                    size_t row_begin = std::min((size_t)NNUE_INPUTS, t * rows_per_thread);
+                    size_t row_end = std::min((size_t)NNUE_INPUTS, row_begin + rows_per_thread);
+                    adam(row_begin * NNUE_HIDDEN, row_end * NNUE_HIDDEN, true);
+                });
+            }
+            for (auto& th : pool) th.join();
+            adam(TRAIN_FT_BIAS, TRAIN_PARAMS, false);
+            for (auto& w : workers) std::fill(w.touched.begin(), w.touched.end(), 0);
+        }
+        
+        // Validation loss over the held-out positions
+        std::vector<double> val_loss(threads, 0.0);
+        std::vector<long long> val_count(threads, 0);
+        std::vector<std::thread> pool;
+        size_t per_thread = (total + threads - 1) / threads;
+        for (int t = 0; t < threads; t++) {
+            pool.emplace_back([&, t]() {
+                size_t begin = std::min(total, t * per_thread);
+                size_t end = std::min(total, begin + per_thread);
+                for (size_t i = begin; i < end; i++) {
+                    PackedPosition rec = data[i];
+                    Position pos;
+                    if (!unpack_position(rec, pos) || pos.hash_key % 64 != 0) continue;
+                    val_loss[t] += train_sample(params, pos, rec.score, rec.result, lambda, nullptr);
+                    val_count[t]++;
+                }
+            });
+        }
+        for (auto& th : pool) th.join();
+        double vloss = 0.0;
+        long long vcount = 0;
+        for (int t = 0; t < threads; t++) {
+            vloss += val_loss[t];
+            vcount += val_count[t];
+        }
+        
+        long long elapsed = std::max(1LL, current_time_ms() - epoch_start);
+        std::cout << "epoch " << epoch
+                  << " train loss " << (epoch_count ? epoch_loss / epoch_count : 0.0)
+                  << " val loss " << (vcount ? vloss / vcount : 0.0)
+                  << " pos/s " << (epoch_count * 1000 / elapsed) << std::endl;
+        
+        std::vector<unsigned char> net = quantize_network(params);
+        if (!write_network(out_path, net) || (!inc_path.empty() && !write_network_inc(inc_path, net))) {
+            std::cerr << "cannot write network" << std::endl;
+            return 1;
+        }
+    }
+    
+    std::cout << "network written to " << out_path << std::endl;
+    return 0;
+}
+
+// ========================================
+// Packed Position Conversion and Shuffling
+// ========================================
+
+// Result token of a labeled text line: 1-0 / 1.0 / 1, 0-1 / 0.0 / 0,
+// 1/2-1/2 / 0.5, with optional quotes or brackets. -1 if unrecognized.
+int parse_result_token(std::string token) {
+    token.erase(std::remove_if(token.begin(), token.end(), [](char c) {
+        return c == '"' || c == '[' || c == ']' || c == ';';
+    }), token.end());
+    if (token == "1-0" || token == "1.0" || token == "1") return 2;
+    if (token == "0-1" || token == "0.0" || token == "0") return 0;
+    if (token == "1/2-1/2" || token == "0.5" || token == "=") return 1;
+    return -1;
+}
+
+// One labeled position per line, in either of the usual layouts:
+//   <fen> | <score> | <result>          score from White's view
+//   <epd> ce <score>; c9 "<result>";    score from the side to move's view
+// The FEN may omit the move counters. Lines without a result are rejected;
+// a missing score is 0.
+bool parse_labeled_line(const std::string& line, Position& pos, int& score, int& result, int& halfmove) {
+    std::istringstream iss(line);
+    std::string field, fen;
+    for (int i = 0; i < 4 && iss >> field; i++) fen += (i ? " " : "") + field;
+    if (std::count(fen.begin(), fen.end(), ' ') != 3) return false;
+    
+    halfmove = 0;
+    score = 0;
+    result = -1;
+    bool white_relative = true;
+    std::vector<std::string> rest;
+    while (iss >> field) rest.push_back(field);
+    size_t i = 0;
+    if (i < rest.size() && isdigit((unsigned char)rest[i][0])) {
+        halfmove = atoi(rest[i++].c_str());
+        if (i < rest.size() && isdigit((unsigned char)rest[i][0])) i++;  // fullmove number
+    }
+    
+    if (i < rest.size() && rest[i] == "|") {
+        if (i + 3 < rest.size() && rest[i + 2] == "|") {
+            score = atoi(rest[i + 1].c_str());
+            result = parse_result_token(rest[i + 3]);
+        } else if (i + 1 < rest.size()) {
+            result = parse_result_token(rest[i + 1]);
+        }
+    } else {
+        for (; i + 1 < rest.size(); i++) {
+            if (rest[i] == "ce") {
+                score = atoi(rest[i + 1].c_str());
+                white_relative = false;
+            } else if (rest[i] == "c9" || rest[i] == "c0" || rest[i] == "result") {
+                result = parse_result_token(rest[i + 1]);
+            }
+        }
+    }
+    if (result < 0) return false;
+    
+    parse_fen(pos, fen + " 0 1");
+    if (count_bits(pos.pieces[WHITE][K]) != 1 || count_bits(pos.pieces[BLACK][K]) != 1) return false;
+    if (!white_relative && pos.side_to_move == BLACK) score = -score;
+    return true;
+}
+
+// convert <in> <out>
+// A .bin input is written out as "<fen> | <score> | <result>" text; any other
+// input is read as labeled FEN/EPD text (see parse_labeled_line) and packed.
+int run_convert(const std::vector<std::string>& args) {
+    if (args.size() < 2) {
+        std::cerr << "usage: convert <in.bin|in.epd> <out.epd|out.bin>" << std::endl;
+        return 1;
+    }
+    const std::string& in_path = args[0];
+    const std::string& out_path = args[1];
+    bool from_binary = in_path.size() >= 4 && in_path.compare(in_path.size() - 4, 4, ".bin") == 0;
+    long long start = current_time_ms();
+    long long converted = 0, skipped = 0;
+    
+    if (from_binary) {
+        PackedPositionFile data;
+        if (!data.open(in_path)) {
+            std::cerr << "cannot read " << in_path << std::endl;
+            return 1;
+        }
+        FILE* out = fopen(out_path.c_str(), "w");
+        if (!out) {
+            std::cerr << "cannot write " << out_path << std::endl;
+            return 1;
+        }
+        const char* results[3] = { "0.0", "0.5", "1.0" };
+        for (size_t i = 0; i < data.size(); i++) {
+            PackedPosition rec = data[i];
+            Position pos;
+            if (!unpack_position(rec, pos)) {
+                skipped++;
+                continue;
+            }
+            fprintf(out, "%s | %d | %s\n", position_to_fen(pos, rec.halfmove_clock).c_str(),
+                    rec.score, results[rec.result]);
+            converted++;
+        }
+        fclose(out);
+    } else {
+        FILE* in = fopen(in_path.c_str(), "r");
+        FILE* out = in ? fopen(out_path.c_str(), "wb") : nullptr;
+        if (!in || !out) {
+            std::cerr << "cannot " << (in ? "write " + out_path : "read " + in_path) << std::endl;
+            if (in) fclose(in);
+            return 1;
+        }
+        std::vector<PackedPosition> buffer;
+        char line[4096];
+        while (fgets(line, sizeof(line), in)) {
+            Position pos;
+            int score, result, halfmove;
+            PackedPosition packed;
+            if (!parse_labeled_line(line, pos, score, result, halfmove) ||
+                !pack_position(pos, score, result, halfmove, packed)) {
+                skipped++;
+                continue;
+            }
+            buffer.push_back(packed);
+            converted++;
+            if (buffer.size() == 4096) {
+                fwrite(buffer.data(), sizeof(PackedPosition), buffer.size(), out);
+                buffer.clear();
+            }
+        }
+        fwrite(buffer.data(), sizeof(PackedPosition), buffer.size(), out);
+        fclose(in);
+        fclose(out);
+    }
+    
+    std::cout << converted << " positions converted, " << skipped << " skipped in "
+              << (current_time_ms() - start) << " ms" << std::endl;
+    return 0;
+}
+
+// shuffle <in.bin> <out.bin> [--memory 1024] [--seed n]
+// Out-of-core shuffle: records are scattered at random over enough temporary
+// bucket files that each fits in --memory MB, then every bucket is shuffled
+// in memory and appended to the output. Both passes are sequential I/O.
+int run_shuffle(const std::vector<std::string>& args) {
+    if (args.size() < 2 || args[0].substr(0, 2) == "--" || args[1].substr(0, 2) == "--") {
+        std::cerr << "usage: shuffle <in.bin> <out.bin> [--memory 1024] [--seed n]" << std::endl;
+        return 1;
+    }
+    const std::string& in_path = args[0];
+    const std::string& out_path = args[1];
+    size_t memory = (size_t)std::max(1LL, std::stoll(arg_value(args, "--memory", "1024"))) << 20;
+    unsigned long long seed = std::stoull(arg_value(args, "--seed", std::to_string(current_time_ms())));
+    std::mt19937_64 rng(seed);
+    
+    PackedPositionFile data;
+    if (!data.open(in_path)) {
+        std::cerr << "cannot read " << in_path << std::endl;
+        return 1;
+    }
+    size_t total = data.size();
+    size_t bucket_capacity = std::max<size_t>(1, memory / sizeof(PackedPosition));
+    // 25% headroom so that an unlucky bucket still fits
+    size_t bucket_count = (total + bucket_capacity - 1) / bucket_capacity;
+    if (bucket_count > 1) bucket_count = bucket_count * 5 / 4 + 1;
+    
+    FILE* out = fopen(out_path.c_str(), "wb");
+    if (!out) {
+        std::cerr << "cannot write " << out_path << std::endl;
+        return 1;
+    }
+    
+    std::vector<PackedPosition> records;
+    if (bucket_count <= 1) {
+        records.reserve(total);
+        for (size_t i = 0; i < total; i++) records.push_back(data[i]);
+        std::shuffle(records.begin(), records.end(), rng);
+        fwrite(records.data(), sizeof(PackedPosition), records.size(), out);
+        fclose(out);
+        std::cout << total << " positions shuffled in memory" << std::endl;
+        return 0;
+    }
+    
+    // Pass 1: scatter
+    const size_t BUCKET_BUFFER = 4096;
+    std::vector<std::string> bucket_paths(bucket_count);
+    std::vector<FILE*> buckets(bucket_count, nullptr);
+    std::vector<std::vector<PackedPosition>> pending(bucket_count);
+    bool ok = true;
+    for (size_t b = 0; b < bucket_count && ok; b++) {
+        bucket_paths[b] = out_path + ".bucket" + std::to_string(b);
+        buckets[b] = fopen(bucket_paths[b].c_str(), "w+b");
+        ok = buckets[b] != nullptr;
+    }
+    for (size_t i = 0; i < total && ok; i++) {
+        size_t b = rng() % bucket_count;
+        pending[b].push_back(data[i]);
+        if (pending[b].size() == BUCKET_BUFFER) {
+            ok = fwrite(pending[b].data(), sizeof(PackedPosition), BUCKET_BUFFER, buckets[b]) == BUCKET_BUFFER;
+            pending[b].clear();
+        }
+    }
+    
+    // Pass 2: shuffle each bucket in memory
+    for (size_t b = 0; b < bucket_count && ok; b++) {
+        fwrite(pending[b].data(), sizeof(PackedPosition), pending[b].size(), buckets[b]);
+        std::vector<PackedPosition>().swap(pending[b]);
+        long count = ftell(buckets[b]) / (long)sizeof(PackedPosition);
+        records.resize((size_t)count);
+        rewind(buckets[b]);
+        ok = fread(records.data(), sizeof(PackedPosition), records.size(), buckets[b]) == records.size();
+        std::shuffle(records.begin(), records.end(), rng);
+        ok = ok && fwrite(records.data(), sizeof(PackedPosition), records.size(), out) == records.size();
+    }
+    
+    for (size_t b = 0; b < bucket_count; b++) {
+        if (buckets[b]) fclose(buckets[b]);
+        remove(bucket_paths[b].c_str());
+    }
+    fclose(out);
+    if (!ok) {
+        std::cerr << "shuffle failed: cannot write temporary or output files" << std::endl;
+        return 1;
+    }
+    std::cout << total << " positions shuffled through " << bucket_count << " buckets" << std::endl;
+    return 0;
+}
+
+// ========================================
+// PGN Import
+// ========================================
+
+struct PgnOptions {
+    bool all_positions = false;         // keep in-check and capture/promotion positions
+    int min_ply = 0;
+};
+
+struct PgnPly {
+    Position pos;
+    int score;                          // White's view
+    int halfmove_clock;
+};
+
+// Parses the games in [begin, end) and hands each finished game's packed
+// positions to emit. Scores come from "[%eval 0.35]" / "[%eval #-3]" comment
+// annotations where present (positions after a mate annotation are dropped),
+// otherwise 0. Games without a 1-0 / 0-1 / 1/2-1/2 result, or with a move that
+// does not decode, are skipped whole.
+void parse_pgn_range(const char* begin, const char* end, const PgnOptions& options,
+                     const std::function<void(const std::vector<PackedPosition>&)>& emit,
+                     long long& games, long long& skipped) {
+    Position pos;
+    std::string fen;
+    std::vector<PgnPly> plies;
+    std::vector<PackedPosition> packed;
+    bool in_game = false, broken = false;
+    int ply = 0, local_halfmove = 0;
+    int eval = 0;
+    bool has_eval = false, mate_eval = false;
+    
+    auto start_game = [&]() {
+        if (fen.empty()) setup_starting_position(pos);
+        else parse_fen(pos, fen);
+        reset_key_stack(pos.hash_key);
+        halfmove_clock = 0;
+        nnue_reset_stack();
+        plies.clear();
+        in_game = true;
+        broken = (count_bits(pos.pieces[WHITE][K]) != 1 || count_bits(pos.pieces[BLACK][K]) != 1);
+        ply = local_halfmove = 0;
+        has_eval = mate_eval = false;
+    };
+    auto finish_game = [&](int result) {
+        if (in_game && !broken && result >= 0) {
+            packed.clear();
+            for (const PgnPly& p : plies) {
+                PackedPosition rec;
+                if (pack_position(p.pos, p.score, result, p.halfmove_clock, rec)) packed.push_back(rec);
+            }
+            if (!packed.empty()) emit(packed);
+            games++;
+        } else if (in_game) {
+            skipped++;
+        }
+        in_game = false;
+        fen.clear();
+    };
+    
+    const char* p = begin;
+    while (p < end) {
+        char c = *p;
+        if (isspace((unsigned char)c)) {
+            p++;
+        } else if (c == '[') {
+            // Tag pair; a tag after movetext means the previous game had no result
+            if (in_game && ply > 0) finish_game(-1);
+            const char* line_end = (const char*)memchr(p, '\n', end - p);
+            if (!line_end) line_end = end;
+            std::string tag(p, line_end);
+            if (tag.compare(0, 5, "[FEN ") == 0) {
+                size_t open = tag.find('"'), close = tag.rfind('"');
+                if (open != std::string::npos && close > open) fen = tag.substr(open + 1, close - open - 1);
+            }
+            p = line_end;
+        } else if (c == '{') {
+            const char* close = (const char*)memchr(p, '}', end - p);
+            if (!close) close = end;
+            std::string comment(p, close);
+            size_t at = comment.find("[%eval ");
+            if (at != std::string::npos) {
+                const char* value = comment.c_str() + at + 7;
+                mate_eval = (*value == '#');
+                eval = mate_eval ? 0 : (int)std::lround(atof(value) * 100.0);
+                has_eval = true;
+            }
+            p = (close < end) ? close + 1 : end;
+        } else if (c == ';' || c == '%') {
+            const char* line_end = (const char*)memchr(p, '\n', end - p);
+            p = line_end ? line_end : end;
+        } else if (c == '(') {
+            int nesting = 0;
+            for (; p < end; p++) {
+                if (*p == '{') {
+                    const char* close = (const char*)memchr(p, '}', end - p);
+                    if (!close) { p = end; break; }
+                    p = close;
+                } else if (*p == '(') {
+                    nesting++;
+                } else if (*p == ')' && --nesting == 0) {
+                    p++;
+                    break;
+                }
+            }
+        } else {
+            const char* token_end = p;
+            while (token_end < end && !isspace((unsigned char)*token_end) && !strchr("{}();[", *token_end)) token_end++;
+            if (token_end == p) {
+                p++;
+                continue;
+            }
+            std::string token(p, token_end);
+            p = token_end;
+            
+            if (token == "1-0" || token == "0-1" || token == "1/2-1/2" || token == "*") {
+                if (!in_game) start_game();
+                finish_game(parse_result_token(token));
+                continue;
+            }
+            if (token[0] == '$') continue;
+            // Move numbers: "12." and "12..."; a move may be glued on ("12.e4")
+            size_t digits = 0;
+            while (digits < token.size() && isdigit((unsigned char)token[digits])) digits++;
+            if (digits > 0) {
+                size_t dots = digits;
+                while (dots < token.size() && token[dots] == '.') dots++;
+                if (dots == digits) continue;
+                token.erase(0, dots);
+                if (token.empty()) continue;
+            }
+            
+            if (!in_game) start_game();
+            if (broken) continue;
+            
+            Move move = parse_san(pos, token);
+            if (move.move == 0) {
+                broken = true;
+                continue;
+            }
+            
+            int us = pos.side_to_move;
+            bool in_check = is_square_attacked(pos, lsb_index(pos.pieces[us][K]), 1 - us);
+            bool noisy = move.is_capture() || move.get_promo() != 0;
+            if (options.all_positions || (!in_check && !noisy && !(has_eval && mate_eval))) {
+                if (ply >= options.min_ply) plies.push_back({ pos, has_eval ? eval : 0, local_halfmove });
+            }
+            
+            make_move(pos, move);
+            nnue_reset_stack();
+            if (is_square_attacked(pos, lsb_index(pos.pieces[us][K]), 1 - us)) broken = true;
+            local_halfmove = (move.is_capture() || move.get_piece() == P) ? 0 : local_halfmove + 1;
+            has_eval = mate_eval = false;
+            ply++;
+        }
+    }
+    if (in_game) finish_game(-1);
+}
+
+// pgn <in.pgn> <out.bin> [--threads n] [--min-ply 0] [--all]
+// The file is memory mapped and cut into one range per thread at "[Event "
+// tags, so every thread parses whole games. Positions before each move are
+// appended with the game result; by default positions in check and positions
+// where the played move is a capture or promotion are left out (--all keeps
+// them). Record order across threads is not preserved; run shuffle anyway.
+int run_pgn(const std::vector<std::string>& args) {
+    if (args.size() < 2 || args[0].substr(0, 2) == "--" || args[1].substr(0, 2) == "--") {
+        std::cerr << "usage: pgn <in.pgn> <out.bin> [--threads n] [--min-ply 0] [--all]" << std::endl;
+        return 1;
+    }
+    PgnOptions options;
+    options.all_positions = std::find(args.begin(), args.end(), "--all") != args.end();
+    options.min_ply = std::stoi(arg_value(args, "--min-ply", "0"));
+    int threads = std::max(1, std::stoi(arg_value(args, "--threads", std::to_string(default_tool_threads()))));
+    
+    MappedFile pgn;
+    if (!pgn.open(args[0])) {
+        std::cerr << "cannot read " << args[0] << std::endl;
+        return 1;
+    }
+    FILE* out = fopen(args[1].c_str(), "wb");
+    if (!out) {
+        std::cerr << "cannot write " << args[1] << std::endl;
+        return 1;
+    }
+    
+    // Split points: the first "[Event " at a line start at or after each cut
+    const char* data = (const char*)pgn.data();
+    size_t size = pgn.size();
+    std::vector<size_t> splits = { 0 };
+    const std::string marker = "\n[Event ";
+    for (int t = 1; t < threads; t++) {
+        size_t cut = std::max(splits.back(), size * t / threads);
+        const char* found = std::search(data + cut, data + size, marker.begin(), marker.end());
+        splits.push_back((found == data + size) ? size : (size_t)(found - data) + 1);
+    }
+    splits.push_back(size);
+    
+    std::mutex out_mutex;
+    long long total_games = 0, total_skipped = 0, total_positions = 0;
+    long long start = current_time_ms();
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.emplace_back([&, t]() {
+            std::vector<PackedPosition> buffer;
+            long long games = 0, skipped = 0;
+            auto flush = [&]() {
+                std::lock_guard<std::mutex> lock(out_mutex);
+                fwrite(buffer.data(), sizeof(PackedPosition), buffer.size(), out);
+                total_positions += (long long)buffer.size();
+                buffer.clear();
+            };
+            parse_pgn_range(data + splits[t], data + splits[t + 1], options,
+                            [&](const std::vector<PackedPosition>& game) {
+                                buffer.insert(buffer.end(), game.begin(), game.end());
+                                if (buffer.size() >= 4096) flush();
+                            }, games, skipped);
+            flush();
+            std::lock_guard<std::mutex> lock(out_mutex);
+            total_games += games;
+            total_skipped += skipped;
+        });
+    }
+    for (auto& worker : pool) worker.join();
+    fclose(out);
+    
+    std::cout << total_positions << " positions from " << total_games << " games (" << total_skipped
+              << " skipped) in " << (current_time_ms() - start) << " ms" << std::endl;
+    return 0;
+}
+
+// ========================================
+// Texel Tuner
+// ========================================
+// Each position is reduced once to the coefficients of the EvalParams it
+// uses (from an EvalTrace) plus an untuned remainder, so the evaluation is
+// linear in the parameters and a gradient step is one pass over that data.
+
+struct TuneCoef {
+    uint16_t index;
+    float value;
+};
+
+struct TuneEntry {
+    size_t first;           // into the coefficient array
+    int count;
+    int phase;
+    float result;           // White's view: 0, 0.5 or 1
+    float constant_mg;      // evaluation not explained by the parameters
+    float constant_eg;
+};
+
+inline int eval_param_index(const Score& param) {
+    return (int)(&param - (const Score*)&eval_params);
+}
+
+void extract_tune_entry(const Position& pos, float result, std::vector<TuneCoef>& coefs, std::vector<TuneEntry>& entries) {
+    static thread_local EvalTrace trace;
+    memset(&trace, 0, sizeof(trace));
+    eval_trace = &trace;
+    evaluate_position_lazy(pos, -INFINITY_SCORE, INFINITY_SCORE);
+    
+    // Material + PST is maintained incrementally, outside the traced terms
+    for (int color = 0; color < 2; color++) {
+        for (int piece = 0; piece < 6; piece++) {
+            U64 bitboard = pos.pieces[color][piece];
+            while (bitboard) {
+                int sq = lsb_index(bitboard);
+                pop_bit(bitboard, sq);
+                int eval_square = (color == WHITE) ? sq : (63 - sq);
+                if (piece != K) trace_param(eval_params.material[piece], 1, color);
+                trace_param(eval_params.pst[piece][eval_square], 1, color);
+            }
+        }
+    }
+    eval_trace = nullptr;
+    
+    const Score* params = (const Score*)&eval_params;
+    TuneEntry entry;
+    entry.first = coefs.size();
+    entry.phase = calculate_phase(pos);
+    entry.result = result;
+    double linear_mg = 0.0, linear_eg = 0.0;
+    for (int i = 0; i < EVAL_PARAM_COUNT; i++) {
+        if (trace.coef[i] == 0.0) continue;
+        coefs.push_back({ (uint16_t)i, (float)trace.coef[i] });
+        linear_mg += trace.coef[i] * mg_value(params[i]);
+        linear_eg += trace.coef[i] * eg_value(params[i]);
+    }
+    entry.count = (int)(coefs.size() - entry.first);
+    entry.constant_mg = (float)(mg_value(trace.total) - linear_mg);
+    entry.constant_eg = (float)(eg_value(trace.total) - linear_eg);
+    entries.push_back(entry);
+}
+
+// White's evaluation under parameters (mg, eg), tempo included
+inline double tune_eval(const TuneEntry& e, const TuneCoef* coefs, const double* mg, const double* eg) {
+    double score_mg = e.constant_mg, score_eg = e.constant_eg;
+    for (int i = 0; i < e.count; i++) {
+        score_mg += coefs[i].value * mg[coefs[i].index];
+        score_eg += coefs[i].value * eg[coefs[i].index];
+    }
+    return (score_mg * e.phase + score_eg * (24 - e.phase)) / 24.0 + 7.0;
+}
+
+inline double tune_sigmoid(double score, double k) {
+    return 1.0 / (1.0 + std::pow(10.0, -k * score / 400.0));
+}
+
+// Write the parameters as a header for DOUCHESS_TUNED_PARAMS builds
+bool write_eval_params_header(const std::string& path, const std::vector<double>& mg, const std::vector<double>& eg) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) return false;
+    fprintf(f, "// Generated by \"douchess tune\". Build with DOUCHESS_TUNED_PARAMS to use it.\n");
+    fprintf(f, "const EvalParams tuned_eval_params = {\n");
+    
+    int index = 0;
+    auto value = [&](int i) {
+        return "S(" + std::to_string((int)std::lround(mg[i])) + ", " + std::to_string((int)std::lround(eg[i])) + ")";
+    };
+    // Eight values per line; multi-dimensional fields get one brace pair per row
+    auto write_row = [&](int length, const char* indent) {
+        for (int col = 0; col < length; col++) {
+            fprintf(f, "%s%s,%s", (col % 8 == 0) ? indent : "", value(index++).c_str(),
+                    (col % 8 == 7 || col == length - 1) ? "\n" : " ");
+        }
+    };
+    for (const EvalParamField& field : eval_param_fields) {
+        if (field.count == 1) {
+            fprintf(f, "    %s,  // %s\n", value(index++).c_str(), field.name);
+        } else if (field.row_length == field.count) {
+            fprintf(f, "    {  // %s\n", field.name);
+            write_row(field.count, "        ");
+            fprintf(f, "    },\n");
+        } else {
+            fprintf(f, "    {  // %s\n", field.name);
+            for (int row = 0; row < field.count / field.row_length; row++) {
+                fprintf(f, "        {\n");
+                write_row(field.row_length, "            ");
+                fprintf(f, "        },\n");
+            }
+            fprintf(f, "    },\n");
+        }
+    }
+    fprintf(f, "};\n");
+    return fclose(f) == 0 && index == EVAL_PARAM_COUNT;
+}
+
+// tune <data.bin> [--out douchess_params.h] [--iterations n] [--lr x]
+//      [--limit n] [--threads n]
+// Labels are the game results of the packed positions; positions with the
+// side to move in check are skipped.
+int run_tune(const std::vector<std::string>& args) {
+    if (args.empty() || args[0].substr(0, 2) == "--") {
+        std::cerr << "usage: tune <data.bin> [--out douchess_params.h] [--iterations 1000]"
+                     " [--lr 1.0] [--limit n] [--threads n]" << std::endl;
+        return 1;
+    }
+    std::string out_path = arg_value(args, "--out", "douchess_params.h");
+    int iterations = std::stoi(arg_value(args, "--iterations", "1000"));
+    double lr = std::stod(arg_value(args, "--lr", "1.0"));
+    long long limit = std::stoll(arg_value(args, "--limit", "0"));
+    int threads = std::max(1, std::stoi(arg_value(args, "--threads", std::to_string(default_tool_threads()))));
+    
+    PackedPositionFile data;
+    if (!data.open(args[0])) {
+        std::cerr << "cannot read " << args[0] << std::endl;
+        return 1;
+    }
+    size_t total = data.size();
+    if (limit > 0) total = std::min(total, (size_t)limit);
+    
+    // Extract coefficients in parallel, then splice the per-thread arrays
+    long long extract_start = current_time_ms();
+    std::vector<std::vector<TuneCoef>> thread_coefs(threads);
+    std::vector<std::vector<TuneEntry>> thread_entries(threads);
+    std::vector<std::thread> pool;
+    size_t per_thread = (total + threads - 1) / threads;
+    for (int t = 0; t < threads; t++) {
+        pool.emplace_back([&, t]() {
+            size_t begin = std::min(total, t * per_thread);
+            size_t end = std::min(total, begin + per_thread);
+            for (size_t i = begin; i < end; i++) {
+                PackedPosition rec = data[i];
+                Position pos;
+                if (!unpack_position(rec, pos)) continue;
+                int king_sq = lsb_index(pos.pieces[pos.side_to_move][K]);
+                if (is_square_attacked(pos, king_sq, 1 - pos.side_to_move)) continue;
+                extract_tune_entry(pos, rec.result / 2.0f, thread_coefs[t], thread_entries[t]);
+            }
+        });
+    }
+    for (auto& th : pool) th.join();
+    
+    std::vector<TuneCoef> coefs;
+    std::vector<TuneEntry> entries;
+    for (int t = 0; t < threads; t++) {
+        size_t offset = coefs.size();
+        coefs.insert(coefs.end(), thread_coefs[t].begin(), thread_coefs[t].end());
+        for (TuneEntry e : thread_entries[t]) {
+            e.first += offset;
+            entries.push_back(e);
+        }
+        std::vector<TuneCoef>().swap(thread_coefs[t]);
+    }
+    if (entries.empty()) {
+        std::cerr << "no usable positions" << std::endl;
+        return 1;
+    }
+    std::cout << "extracted " << entries.size() << " positions, " << coefs.size() << " coefficients in "
+              << (current_time_ms() - extract_start) << " ms" << std::endl;
+    
+    std::vector<double> mg(EVAL_PARAM_COUNT), eg(EVAL_PARAM_COUNT);
+    const Score* params = (const Score*)&eval_params;
+    for (int i = 0; i < EVAL_PARAM_COUNT; i++) {
+        mg[i] = mg_value(params[i]);
+        eg[i] = eg_value(params[i]);
+    }
+    
+    // Loss (and optionally its gradient) over all entries, split across threads
+    std::vector<std::vector<double>> thread_grad(threads, std::vector<double>(2 * EVAL_PARAM_COUNT));
+    auto loss_and_gradient = [&](double k, bool gradient) {
+        std::vector<double> thread_loss(threads, 0.0);
+        std::vector<std::thread> workers;
+        size_t per = (entries.size() + threads - 1) / threads;
+        for (int t = 0; t < threads; t++) {
+            workers.emplace_back([&, t]() {
+                std::vector<double>& grad = thread_grad[t];
+                if (gradient) std::fill(grad.begin(), grad.end(), 0.0);
+                size_t begin = std::min(entries.size(), t * per);
+                size_t end = std::min(entries.size(), begin + per);
+                for (size_t i = begin; i < end; i++) {
+                    const TuneEntry& e = entries[i];
+                    const TuneCoef* c = &coefs[e.first];
+                    double s = tune_sigmoid(tune_eval(e, c, mg.data(), eg.data()), k);
+                    double err = e.result - s;
+                    thread_loss[t] += err * err;
+                    if (!gradient) continue;
+                    // d(err^2)/d(eval), split by phase weight
+                    double d = -2.0 * err * s * (1.0 - s) * std::log(10.0) * k / 400.0;
+                    double d_mg = d * e.phase / 24.0, d_eg = d * (24 - e.phase) / 24.0;
+                    for (int j = 0; j < e.count; j++) {
+                        grad[c[j].index] += d_mg * c[j].value;
+                        grad[EVAL_PARAM_COUNT + c[j].index] += d_eg * c[j].value;
+                    }
+                }
+            });
+        }
+        for (auto& th : workers) th.join();
+        double loss = 0.0;
+        for (double l : thread_loss) loss += l;
+        return loss / entries.size();
+    };
+    
+    // Fit the scaling constant K for the starting parameters
+    double k = 1.0;
+    for (double step = 0.5; step > 0.0005; step /= 4.0) {
+        double best = loss_and_gradient(k, false);
+        while (true) {
+            double up = loss_and_gradient(k + step, false);
+            double down = (k - step > 0.0) ? loss_and_gradient(k - step, false) : 1e9;
+            if (up < best && up <= down) { k += step; best = up; }
+            else if (down < best) { k -= step; best = down; }
+            else break;
+        }
+    }
+    std::cout << "K = " << k << ", initial loss " << loss_and_gradient(k, false) << std::endl;
+    
+    // Full-batch Adam, step size in centipawns
+    std::vector<double> step(EVAL_PARAM_COUNT);
+    int param = 0;
+    for (const EvalParamField& field : eval_param_fields) {
+        for (int i = 0; i < field.count; i++) step[param++] = field.step;
+    }
+    std::vector<double> m(2 * EVAL_PARAM_COUNT, 0.0), v(2 * EVAL_PARAM_COUNT, 0.0);
+    const double beta1 = 0.9, beta2 = 0.999, eps = 1e-8;
+    for (int iter = 1; iter <= iterations; iter++) {
+        double loss = loss_and_gradient(k, true);
+        for (int i = 0; i < 2 * EVAL_PARAM_COUNT; i++) {
+            double g = 0.0;
+            for (int t = 0; t < threads; t++) g += thread_grad[t][i];
+            g /= entries.size();
+            m[i] = beta1 * m[i] + (1.0 - beta1) * g;
+            v[i] = beta2 * v[i] + (1.0 - beta2) * g * g;
+            double m_hat = m[i] / (1.0 - std::pow(beta1, iter));
+            double v_hat = v[i] / (1.0 - std::pow(beta2, iter));
+            int index = i % EVAL_PARAM_COUNT;
+            double& value = (i < EVAL_PARAM_COUNT) ? mg[index] : eg[index];
+            value -= lr * step[index] * m_hat / (std::sqrt(v_hat) + eps);
+        }
+        if (iter % 50 == 0 || iter == iterations) {
+            std::cout << "iteration " << iter << " loss " << loss << std::endl;
+            if (!write_eval_params_header(out_path, mg, eg)) {
+                std::cerr << "cannot write " << out_path << std::endl;
+                return 1;
+            }
+        }
+    }
+    
+    std::cout << "parameters written to " << out_path << std::endl;
+    return 0;
+}
+
+// ========================================
+// Self-Play: SPSA, Matches and Data Generation
+// ========================================
+// Games are played in-process. Search state is thread_local, so every worker
+// thread is an independent engine; each side of a game brings its own
+// parameters, limits and TT, which are swapped in before it searches. A side
+// can also be an external UCI engine running as a child process.
+
+const size_t SELFPLAY_TT_ENTRIES = 1 << 16;
+const int SELFPLAY_MAX_PLIES = 400;
+
+// External UCI engine on the other end of a pair of pipes
+class UciProcess {
+public:
+    UciProcess() = default;
+    UciProcess(const UciProcess&) = delete;
+    UciProcess& operator=(const UciProcess&) = delete;
+    ~UciProcess() { stop(); }
+    
+    bool start(const std::string& command) {
+#ifdef _WIN32
+        SECURITY_ATTRIBUTES sa = { sizeof(sa), nullptr, TRUE };
+        HANDLE child_in = nullptr, child_out = nullptr;
+        if (!CreatePipe(&child_in, &to_child, &sa, 0)) return false;
+        if (!CreatePipe(&from_child, &child_out, &sa, 0)) {
+            CloseHandle(child_in);
+            return false;
+        }
+        SetHandleInformation(to_child, HANDLE_FLAG_INHERIT, 0);
+        SetHandleInformation(from_child, HANDLE_FLAG_INHERIT, 0);
+        
+        STARTUPINFOA si = {};
+        si.cb = sizeof(si);
+        si.dwFlags = STARTF_USESTDHANDLES;
+        si.hStdInput = child_in;
+        si.hStdOutput = child_out;
+        si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+        std::vector<char> command_line(command.begin(), command.end());
+        command_line.push_back('\0');
+        bool ok = CreateProcessA(nullptr, command_line.data(), nullptr, nullptr, TRUE, 0,
+                                 nullptr, nullptr, &si, &process_info) != 0;
+        CloseHandle(child_in);
+        CloseHandle(child_out);
+        if (!ok) {
+            stop();
+            return false;
+        }
+        running = true;
+#else
+        int in_pipe[2], out_pipe[2];
+        if (pipe(in_pipe) != 0) return false;
+        if (pipe(out_pipe) != 0) {
+            ::close(in_pipe[0]);
+            ::close(in_pipe[1]);
+            return false;
+        }
+        // Our ends must not leak into engines started by other threads
+        fcntl(in_pipe[1], F_SETFD, FD_CLOEXEC);
+        fcntl(out_pipe[0], F_SETFD, FD_CLOEXEC);
+        signal(SIGPIPE, SIG_IGN);  // a crashed engine is reported by send()
+        
+        pid = fork();
+        if (pid == 0) {
+            dup2(in_pipe[0], STDIN_FILENO);
+            dup2(out_pipe[1], STDOUT_FILENO);
+            ::close(in_pipe[0]);
+            ::close(out_pipe[1]);
+            execl("/bin/sh", "sh", "-c", command.c_str(), (char*)nullptr);
+            _exit(127);
+        }
+        ::close(in_pipe[0]);
+        ::close(out_pipe[1]);
+        to_child = in_pipe[1];
+        from_child = out_pipe[0];
+        if (pid < 0) {
+            stop();
+            return false;
+        }
+        running = true;
+#endif
+        return true;
+    }
+    
+    bool send(const std::string& line) {
+        if (!running) return false;
+        std::string text = line + "\n";
+#ifdef _WIN32
+        DWORD written = 0;
+        return WriteFile(to_child, text.data(), (DWORD)text.size(), &written, nullptr) && written == text.size();
+#else
+        return write(to_child, text.data(), text.size()) == (ssize_t)text.size();
+#endif
+    }
+    
+    // Blocking; false once the engine has exited
+    bool read_line(std::string& line) {
+        while (running) {
+            size_t newline = pending.find('\n');
+            if (newline != std::string::npos) {
+                line = pending.substr(0, newline);
+                pending.erase(0, newline + 1);
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                return true;
+            }
+            char buffer[4096];
+#ifdef _WIN32
+            DWORD count = 0;
+            if (!ReadFile(from_child, buffer, sizeof(buffer), &count, nullptr) || count == 0) return false;
+#else
+            ssize_t count = read(from_child, buffer, sizeof(buffer));
+            if (count <= 0) return false;
+#endif
+            pending.append(buffer, (size_t)count);
+        }
+        return false;
+    }
+    
+    // Read until a line starting with prefix; false if the engine exited
+    bool wait_for(const std::string& prefix) {
+        std::string line;
+        while (read_line(line)) {
+            if (line.compare(0, prefix.size(), prefix) == 0) return true;
+        }
+        return false;
+    }
+    
+    void stop() {
+#ifdef _WIN32
+        if (running) {
+            send("quit");
+            if (WaitForSingleObject(process_info.hProcess, 2000) == WAIT_TIMEOUT) {
+                TerminateProcess(process_info.hProcess, 1);
+            }
+        }
+        if (process_info.hProcess) CloseHandle(process_info.hProcess);
+        if (process_info.hThread) CloseHandle(process_info.hThread);
+        if (to_child) CloseHandle(to_child);
+        if (from_child) CloseHandle(from_child);
+        process_info = PROCESS_INFORMATION();
+        to_child = from_child = nullptr;
+#else
+        if (running) send("quit");
+        if (to_child >= 0) ::close(to_child);
+        if (from_child >= 0) ::close(from_child);
+        if (pid > 0) waitpid(pid, nullptr, 0);
+        to_child = from_child = -1;
+        pid = -1;
+#endif
+        running = false;
+        pending.clear();
+    }
+    
+private:
+    bool running = false;
+    std::string pending;
+#ifdef _WIN32
+    PROCESS_INFORMATION process_info = {};
+    HANDLE to_child = nullptr;
+    HANDLE from_child = nullptr;
+#else
+    pid_t pid = -1;
+    int to_child = -1;
+    int from_child = -1;
+#endif
+};
+
+struct PlayerConfig {
+    SearchParams params;
+    long long nodes = 0;                // per move; 0 = no limit
+    int depth = 0;                      // per move; 0 = no limit
+    long long movetime = 0;             // ms per move; 0 = no limit
+    long long time = 0;                 // ms per game (with inc ms per move); 0 = none
+    long long inc = 0;
+    std::string command;                // external UCI engine; empty = this engine in-process
+    std::vector<std::pair<std::string, std::string>> uci_options;  // sent to an external engine
+};
+
+struct SelfPlayer {
+    PlayerConfig config;
+    std::vector<TTEntry> tt;
+    std::unique_ptr<UciProcess> process;
+    long long clock = 0;                // ms left in the current game
+    
+    explicit SelfPlayer(const PlayerConfig& c) : config(c) {
+        if (config.command.empty()) tt.resize(SELFPLAY_TT_ENTRIES);
+    }
+    
+    // Starts the external engine on first use; false if it fails to answer
+    bool new_game() {
+        clock = config.time;
+        if (config.command.empty()) {
+            std::fill(tt.begin(), tt.end(), TTEntry());
+            return true;
+        }
+        if (!process) {
+            process.reset(new UciProcess());
+            if (!process->start(config.command) || !process->send("uci") || !process->wait_for("uciok")) {
+                process.reset();
+                return false;
+            }
+            for (const auto& option : config.uci_options) {
+                process->send("setoption name " + option.first + " value " + option.second);
+            }
+        }
+        return process->send("ucinewgame") && process->send("isready") && process->wait_for("readyok");
+    }
+};
+
+// Adjudication: a side is won once both engines report at least win_score
+// for win_plies plies in a row; a game is drawn after draw_move_number full
+// moves once the scores stay within draw_score for draw_plies plies
+struct Adjudication {
+    int win_score = 1000;
+    int win_plies = 6;
+    int draw_move_number = 40;
+    int draw_score = 10;
+    int draw_plies = 10;
+};
+
+struct GamePly {
+    Position pos;
+    int score;                          // side to move's view
+    Move move;
+    int halfmove_clock;
+};
+
+// Search pos with this player's settings. History tables are cleared every
+// move since the same thread searches for both sides. position_command is
+// the game so far in UCI form, for external engines.
+Move selfplay_think(SelfPlayer& player, Position& pos, const std::string& position_command,
+                    long long wtime, long long btime, int& score) {
+    const PlayerConfig& config = player.config;
+    score = 0;
+    
+    if (player.process) {
+        std::ostringstream go;
+        go << "go";
+        if (config.time > 0) {
+            go << " wtime " << wtime << " btime " << btime << " winc " << config.inc << " binc " << config.inc;
+        }
+        if (config.movetime > 0) go << " movetime " << config.movetime;
+        if (config.nodes > 0) go << " nodes " << config.nodes;
+        if (config.depth > 0) go << " depth " << config.depth;
+        if (!player.process->send(position_command) || !player.process->send(go.str())) return Move();
+        
+        std::string line;
+        while (player.process->read_line(line)) {
+            std::istringstream iss(line);
+            std::string token;
+            iss >> token;
+            if (token == "bestmove") {
+                iss >> token;
+                return parse_move(pos, token);
+            }
+            if (token != "info") continue;
+            while (iss >> token) {
+                if (token != "score") continue;
+                std::string kind;
+                int value = 0;
+                iss >> kind >> value;
+                if (kind == "cp") score = value;
+                else if (kind == "mate") score = (value > 0) ? MATE_SCORE - value : -MATE_SCORE - value;
+            }
+        }
+        return Move();
+    }
+    
+    tt_table = player.tt.data();
+    tt_entries = player.tt.size();
+    search_params = config.params;
+    node_limit = config.nodes;
+    depth_limit = (config.depth > 0) ? std::min(config.depth, MAX_DEPTH) : MAX_DEPTH;
+    if (config.movetime > 0) {
+        time_limit = config.movetime;
+    } else if (config.time > 0) {
+        long long clock = (pos.side_to_move == WHITE) ? wtime : btime;
+        time_limit = calculate_time_for_move((int)clock, (int)config.inc, 40);
+    } else {
+        time_limit = 1LL << 40;
+    }
+    search_silent = true;
+    clear_history();
+    
+    Move move = search_position(pos);
+    score = root_score;
+    return move;
+}
+
+bool insufficient_material(const Position& pos) {
+    for (int color = WHITE; color <= BLACK; color++) {
+        if (pos.pieces[color][P] | pos.pieces[color][R] | pos.pieces[color][Q]) return false;
+    }
+    U64 minors = pos.pieces[WHITE][N] | pos.pieces[WHITE][B] | pos.pieces[BLACK][N] | pos.pieces[BLACK][B];
+    return count_bits(minors) <= 1;
+}
+
+// Game result at pos from the rules alone: 0 = Black won, 1 = draw,
+// 2 = White won, -1 = not over. Uses the thread's key stack and halfmove clock.
+int rules_result(Position& pos) {
+    MoveList moves = generate_legal_moves(pos);
+    if (moves.moves.empty()) {
+        int us = pos.side_to_move;
+        int king_sq = lsb_index(pos.pieces[us][K]);
+        if (!is_square_attacked(pos, king_sq, 1 - us)) return 1;
+        return (us == WHITE) ? 0 : 2;
+    }
+    if (halfmove_clock >= 100 || insufficient_material(pos)) return 1;
+    
+    int repeats = 0;
+    int end = std::min(halfmove_clock, key_count - 1);
+    for (int i = 4; i <= end; i += 2) {
+        if (key_stack[key_count - 1 - i] == pos.hash_key && ++repeats >= 2) return 1;
+    }
+    return -1;
+}
+
+// Play one game from start; returns the result as in rules_result. A side
+// that fails to move (illegal move, crash, flag fall) loses. Every searched
+// position is appended to plies when given.
+int play_game(SelfPlayer& white, SelfPlayer& black, const Position& start,
+              const Adjudication& adj, std::vector<GamePly>* plies = nullptr) {
+    if (!white.new_game()) return 0;
+    if (!black.new_game()) return 2;
+    
+    Position pos = start;
+    halfmove_clock = 0;
+    reset_key_stack(pos.hash_key);
+    nnue_reset_stack();
+    
+    std::string position_command = "position fen " + position_to_fen(pos);
+    int win_count = 0, loss_count = 0, draw_count = 0;
+    for (int ply = 0; ply < SELFPLAY_MAX_PLIES; ply++) {
+        int result = rules_result(pos);
+        if (result >= 0) return result;
+        
+        int us = pos.side_to_move;
+        SelfPlayer& player = (us == WHITE) ? white : black;
+        int lost = (us == WHITE) ? 0 : 2;
+        int score = 0;
+        long long think_start = current_time_ms();
+        Move move = selfplay_think(player, pos, position_command, white.clock, black.clock, score);
+        if (move.move == 0) return lost;
+        if (player.config.time > 0) {
+            player.clock -= current_time_ms() - think_start;
+            if (player.clock < 0) return lost;
+            player.clock += player.config.inc;
+        }
+        if (plies) plies->push_back({ pos, score, move, halfmove_clock });
+        
+        // Adjudication counters are kept from White's point of view
+        int white_score = (us == WHITE) ? score : -score;
+        win_count = (white_score >= adj.win_score) ? win_count + 1 : 0;
+        loss_count = (white_score <= -adj.win_score) ? loss_count + 1 : 0;
+        draw_count = (std::abs(score) <= adj.draw_score) ? draw_count + 1 : 0;
+        if (win_count >= adj.win_plies) return 2;
+        if (loss_count >= adj.win_plies) return 0;
+        if (ply / 2 >= adj.draw_move_number && draw_count >= adj.draw_plies) return 1;
+        
+        position_command += (ply == 0 ? " moves " : " ") + move_to_string(move);
+        make_move(pos, move);
+        nnue_reset_stack();
+    }
+    return 1;
+}
+
+// Startpos followed by random legal moves; retried if the line ends the game
+Position random_opening(std::mt19937_64& rng, int plies) {
+    while (true) {
+        Position pos;
+        setup_starting_position(pos);
+        halfmove_clock = 0;
+        reset_key_stack(pos.hash_key);
+        nnue_reset_stack();
+        
+        bool ok = true;
+        for (int i = 0; i < plies && ok; i++) {
+            MoveList moves = generate_legal_moves(pos);
+            if (moves.moves.empty()) {
+                ok = false;
+                break;
+            }
+            make_move(pos, moves.moves[rng() % moves.moves.size()]);
+            nnue_reset_stack();
+        }
+        if (ok && rules_result(pos) < 0) return pos;
+    }
+}
+
+// EPD/FEN file, one position per line; only the first four fields are used
+std::vector<std::string> load_openings(const std::string& path) {
+    std::vector<std::string> openings;
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) return openings;
+    
+    char buffer[1024];
+    while (fgets(buffer, sizeof(buffer), f)) {
+        std::istringstream iss(buffer);
+        std::string field, fen;
+        for (int i = 0; i < 4 && iss >> field; i++) fen += (i ? " " : "") + field;
+        if (std::count(fen.begin(), fen.end(), ' ') != 3) continue;
+        
+        Position pos;
+        parse_fen(pos, fen + " 0 1");
+        if (count_bits(pos.pieces[WHITE][K]) == 1 && count_bits(pos.pieces[BLACK][K]) == 1) {
+            openings.push_back(fen + " 0 1");
+        }
+    }
+    fclose(f);
+    return openings;
+}
+
+Position pick_opening(const std::vector<std::string>& openings, std::mt19937_64& rng, int random_plies) {
+    if (openings.empty()) return random_opening(rng, random_plies);
+    Position pos;
+    parse_fen(pos, openings[rng() % openings.size()]);
+    return pos;
+}
+
+void write_search_params(FILE* f, const SearchParams& params) {
+    for (const TunableParam& tp : tunable_params) {
+        fprintf(f, "%s %d\n", tp.name, params.*tp.field);
+    }
+}
+
+// spsa [--iterations n] [--nodes n] [--depth n] [--threads n] [--openings file.epd]
+//      [--random-plies n] [--r-end x] [--seed n] [--out spsa_params.txt]
+// Each iteration plays a game pair, colors swapped, between theta + c*delta
+// and theta - c*delta, delta = +/-1 per parameter, and moves theta along the
+// result. Gains follow the usual c_end/r_end schedule: c decays from
+// c_end * N^0.101 to c_end and a = r_end * c_end^2 * (A + N)^0.602.
+// Workers run iterations asynchronously against the shared theta.
+int run_spsa(const std::vector<std::string>& args) {
+    int iterations = std::max(1, std::stoi(arg_value(args, "--iterations", "1000")));
+    long long nodes = std::stoll(arg_value(args, "--nodes", "5000"));
+    int depth = std::stoi(arg_value(args, "--depth", "0"));
+    int threads = std::max(1, std::stoi(arg_value(args, "--threads", std::to_string(default_tool_threads()))));
+    int random_plies = std::stoi(arg_value(args, "--random-plies", "8"));
+    double r_end = std::stod(arg_value(args, "--r-end", "0.002"));
+    unsigned long long seed = std::stoull(arg_value(args, "--seed", std::to_string(current_time_ms())));
+    std::string out_path = arg_value(args, "--out", "spsa_params.txt");
+    std::string openings_path = arg_value(args, "--openings", "");
+    
+    std::vector<std::string> openings;
+    if (!openings_path.empty()) {
+        openings = load_openings(openings_path);
+        if (openings.empty()) {
+            std::cerr << "no positions in " << openings_path << std::endl;
+            return 1;
+        }
+    }
+    
+    const double alpha = 0.602, gamma = 0.101;
+    const double big_a = 0.1 * iterations;
+    
+    // theta starts from the current values (DOUCHESS_PARAMS applies)
+    std::vector<double> theta(TUNABLE_COUNT);
+    for (int i = 0; i < TUNABLE_COUNT; i++) theta[i] = search_params.*tunable_params[i].field;
+    
+    std::mutex theta_mutex;
+    int next_iteration = 0;
+    int wins = 0, draws = 0, losses = 0;  // theta+ results
+    long long start = current_time_ms();
+    
+    auto to_params = [](const std::vector<double>& values) {
+        SearchParams params;
+        for (int i = 0; i < TUNABLE_COUNT; i++) {
+            const TunableParam& tp = tunable_params[i];
+            params.*tp.field = std::max(tp.min, std::min((int)std::lround(values[i]), tp.max));
+        }
+        return params;
+    };
+    
+    auto save = [&]() {
+        FILE* f = fopen(out_path.c_str(), "w");
+        if (!f) return false;
+        write_search_params(f, to_params(theta));
+        fclose(f);
+        return true;
+    };
+    
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.emplace_back([&, t]() {
+            std::mt19937_64 rng(seed + t * 0x9E3779B97F4A7C15ULL);
+            Adjudication adj;
+            while (true) {
+                int k;
+                std::vector<double> c(TUNABLE_COUNT), delta(TUNABLE_COUNT);
+                std::vector<double> plus(TUNABLE_COUNT), minus(TUNABLE_COUNT);
+                {
+                    std::lock_guard<std::mutex> lock(theta_mutex);
+                    if (next_iteration >= iterations) return;
+                    k = ++next_iteration;
+                    for (int i = 0; i < TUNABLE_COUNT; i++) {
+                        c[i] = tunable_params[i].spsa_c * std::pow((double)iterations, gamma) / std::pow((double)k, gamma);
+                        delta[i] = (rng() & 1) ? 1.0 : -1.0;
+                        plus[i] = theta[i] + c[i] * delta[i];
+                        minus[i] = theta[i] - c[i] * delta[i];
+                    }
+                }
+                
+                PlayerConfig plus_config, minus_config;
+                plus_config.params = to_params(plus);
+                minus_config.params = to_params(minus);
+                plus_config.nodes = minus_config.nodes = nodes;
+                plus_config.depth = minus_config.depth = depth;
+                SelfPlayer plus_player(plus_config), minus_player(minus_config);
+                
+                Position opening = pick_opening(openings, rng, random_plies);
+                int first = play_game(plus_player, minus_player, opening, adj);
+                int second = play_game(minus_player, plus_player, opening, adj);
+                // theta+ points minus theta- points over the pair, -2..2; the step
+                // below uses the per-game average result / 2.0, in -1..1
+                int result = (first - 1) - (second - 1);
+                
+                std::lock_guard<std::mutex> lock(theta_mutex);
+                for (int i = 0; i < TUNABLE_COUNT; i++) {
+                    const TunableParam& tp = tunable_params[i];
+                    double a_end = r_end * tp.spsa_c * tp.spsa_c;
+                    double a_k = a_end * std::pow(big_a + iterations, alpha) / std::pow(big_a + k, alpha);
+                    theta[i] += a_k * (result / 2.0) * delta[i] / c[i];
+                    theta[i] = std::max((double)tp.min, std::min(theta[i], (double)tp.max));
+                }
+                for (int game : { first, 2 - second }) {
+                    if (game == 2) wins++;
+                    else if (game == 1) draws++;
+                    else losses++;
+                }
+                
+                int done = wins + draws + losses;
+                if (done % 200 == 0) {
+                    std::cout << "iteration " << done / 2 << " games " << done
+                              << " +" << wins << " =" << draws << " -" << losses
+                              << " time " << (current_time_ms() - start) / 1000 << "s" << std::endl;
+                    for (int i = 0; i < TUNABLE_COUNT; i++) {
+                        std::cout << "  " << tunable_params[i].name << " " << theta[i] << std::endl;
+                    }
+                    save();
+                }
+            }
+        });
+    }
+    for (auto& worker : pool) worker.join();
+    
+    if (!save()) {
+        std::cerr << "cannot write " << out_path << std::endl;
+        return 1;
+    }
+    std::cout << "parameters written to " << out_path << std::endl;
+    write_search_params(stdout, to_params(theta));
+    return 0;
+}
+
+// "Name=value,Name=value": search tunables for this engine, or UCI options
+// passed through to an external engine
+bool parse_player_options(const std::string& spec, PlayerConfig& config) {
+    std::istringstream iss(spec);
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+        if (item.empty()) continue;
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) return false;
+        std::string name = item.substr(0, eq), value = item.substr(eq + 1);
+        if (!config.command.empty()) {
+            config.uci_options.push_back({ name, value });
+        } else if (!set_search_param(config.params, name, atoi(value.c_str()))) {
+            std::cerr << "unknown parameter " << name << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+double score_to_elo(double score) {
+    score = std::max(1e-6, std::min(score, 1.0 - 1e-6));
+    return -400.0 * std::log10(1.0 / score - 1.0);
+}
+
+double elo_to_score(double elo) {
+    return 1.0 / (1.0 + std::pow(10.0, -elo / 400.0));
+}
+
+// Game pairs (same opening, colors swapped) counted by A's score 0, 1/2, 1,
+// 3/2, 2. Pairs are the independent samples; the pentanomial model accounts
+// for the correlation between the two games of a pair.
+struct MatchStats {
+    long long pairs[5] = {};
+    long long wins = 0, draws = 0, losses = 0;
+    
+    // Pair count, per-game mean score and per-pair variance. The variance gets
+    // half a pseudo-pair in every bin so that the first few pairs cannot
+    // produce a near-zero variance (and an instant SPRT decision).
+    void moments(double& n, double& mean, double& var) const {
+        n = 0;
+        double total = 0, prior_n = 0, prior_total = 0, prior_square = 0;
+        for (int i = 0; i < 5; i++) {
+            double x = i / 4.0;
+            n += pairs[i];
+            total += pairs[i] * x;
+            prior_n += pairs[i] + 0.5;
+            prior_total += (pairs[i] + 0.5) * x;
+            prior_square += (pairs[i] + 0.5) * x * x;
+        }
+        mean = (n > 0) ? total / n : 0.5;
+        double prior_mean = prior_total / prior_n;
+        var = prior_square / prior_n - prior_mean * prior_mean;
+        n = std::max(n, 1.0);
+    }
+    
+    // Generalized SPRT, normal approximation: H0 elo = elo0 against H1 elo = elo1
+    double llr(double elo0, double elo1) const {
+        double n, mean, var;
+        moments(n, mean, var);
+        double s0 = elo_to_score(elo0), s1 = elo_to_score(elo1);
+        return n * (s1 - s0) * (2.0 * mean - s0 - s1) / (2.0 * var);
+    }
+    
+    // Elo difference and the half-width of its 95% interval
+    void elo(double& diff, double& error) const {
+        double n, mean, var;
+        moments(n, mean, var);
+        double margin = 1.959964 * std::sqrt(var / n);
+        diff = score_to_elo(mean);
+        error = (score_to_elo(mean + margin) - score_to_elo(mean - margin)) / 2.0;
+    }
+};
+
+// match [--a Name=v,...] [--b Name=v,...] [--a-cmd engine] [--b-cmd engine]
+//       [--games 1000] [--threads n] [--openings file.epd] [--random-plies 8]
+//       [--tc 10+0.1 | --movetime ms | --nodes n | --depth n]
+//       [--sprt elo0,elo1] [--alpha 0.05] [--beta 0.05] [--report 10] [--seed n]
+// Engine A and B are this engine with the given search parameters, or
+// external UCI engines (--a-cmd / --b-cmd, with --a / --b as their options).
+// Games are played in pairs from the same opening with colors swapped. With
+// --sprt the match stops as soon as either hypothesis is accepted.
+int run_match(const std::vector<std::string>& args) {
+    PlayerConfig config_a, config_b;
+    config_a.params = config_b.params = search_params;
+    config_a.command = arg_value(args, "--a-cmd", "");
+    config_b.command = arg_value(args, "--b-cmd", "");
+    if (!parse_player_options(arg_value(args, "--a", ""), config_a) ||
+        !parse_player_options(arg_value(args, "--b", ""), config_b)) {
+        std::cerr << "usage: match [--a Name=v,...] [--b Name=v,...] [--a-cmd engine] [--b-cmd engine]"
+                     " [--games 1000] [--threads n] [--openings file.epd] [--tc 10+0.1 | --movetime ms"
+                     " | --nodes n | --depth n] [--sprt elo0,elo1]" << std::endl;
+        return 1;
+    }
+    
+    std::string tc = arg_value(args, "--tc", "");
+    long long movetime = std::stoll(arg_value(args, "--movetime", "0"));
+    long long nodes = std::stoll(arg_value(args, "--nodes", "0"));
+    int depth = std::stoi(arg_value(args, "--depth", "0"));
+    if (tc.empty() && movetime == 0 && depth == 0 && nodes == 0) nodes = 10000;
+    for (PlayerConfig* config : { &config_a, &config_b }) {
+        if (!tc.empty()) {
+            size_t plus = tc.find('+');
+            config->time = (long long)(std::stod(tc.substr(0, plus)) * 1000);
+            config->inc = (plus == std::string::npos) ? 0 : (long long)(std::stod(tc.substr(plus + 1)) * 1000);
+        }
+        config->movetime = movetime;
+        config->nodes = nodes;
+        config->depth = depth;
+    }
+    
+    int games = std::max(2, std::stoi(arg_value(args, "--games", "1000")));
+    int threads = std::max(1, std::stoi(arg_value(args, "--threads", std::to_string(default_tool_threads()))));
+    int random_plies = std::stoi(arg_value(args, "--random-plies", "8"));
+    int report_every = std::max(1, std::stoi(arg_value(args, "--report", "10")));
+    unsigned long long seed = std::stoull(arg_value(args, "--seed", std::to_string(current_time_ms())));
+    std::string openings_path = arg_value(args, "--openings", "");
+    std::string sprt = arg_value(args, "--sprt", "");
+    double alpha = std::stod(arg_value(args, "--alpha", "0.05"));
+    double beta = std::stod(arg_value(args, "--beta", "0.05"));
+    double elo0 = 0, elo1 = 0;
+    if (!sprt.empty()) {
+        size_t comma = sprt.find(',');
+        if (comma == std::string::npos) {
+            std::cerr << "--sprt expects elo0,elo1" << std::endl;
+            return 1;
+        }
+        elo0 = std::stod(sprt.substr(0, comma));
+        elo1 = std::stod(sprt.substr(comma + 1));
+    }
+    double lower_bound = std::log(beta / (1.0 - alpha));
+    double upper_bound = std::log((1.0 - beta) / alpha);
+    
+    std::vector<std::string> openings;
+    if (!openings_path.empty()) {
+        openings = load_openings(openings_path);
+        if (openings.empty()) {
+            std::cerr << "no positions in " << openings_path << std::endl;
+            return 1;
+        }
+    }
+    
+    std::mutex stats_mutex;
+    MatchStats stats;
+    int next_pair = 0;
+    int total_pairs = games / 2;
+    std::atomic<bool> finished{false};
+    long long start = current_time_ms();
+    
+    auto report = [&]() {
+        double diff, error;
+        stats.elo(diff, error);
+        long long played = stats.wins + stats.draws + stats.losses;
+        printf("games %lld: +%lld =%lld -%lld  score %.1f%%  elo %.1f +/- %.1f",
+               played, stats.wins, stats.draws, stats.losses,
+               100.0 * (stats.wins + 0.5 * stats.draws) / std::max(1LL, played), diff, error);
+        if (!sprt.empty()) printf("  llr %.2f (%.2f, %.2f)", stats.llr(elo0, elo1), lower_bound, upper_bound);
+        printf("  time %llds\n", (current_time_ms() - start) / 1000);
+        fflush(stdout);
+    };
+    
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.emplace_back([&, t]() {
+            std::mt19937_64 rng(seed + t * 0x9E3779B97F4A7C15ULL);
+            Adjudication adj;
+            SelfPlayer player_a(config_a), player_b(config_b);
+            while (!finished) {
+                {
+                    std::lock_guard<std::mutex> lock(stats_mutex);
+                    if (next_pair >= total_pairs) return;
+                    next_pair++;
+                }
+                
+                Position opening = pick_opening(openings, rng, random_plies);
+                int first = play_game(player_a, player_b, opening, adj);       // A plays White
+                int second = 2 - play_game(player_b, player_a, opening, adj);  // A plays Black
+                
+                std::lock_guard<std::mutex> lock(stats_mutex);
+                if (finished) return;
+                stats.pairs[first + second]++;
+                for (int game : { first, second }) {
+                    if (game == 2) stats.wins++;
+                    else if (game == 1) stats.draws++;
+                    else stats.losses++;
+                }
+                long long done = stats.wins + stats.draws + stats.losses;
+                bool decided = false;
+                if (!sprt.empty()) {
+                    double llr = stats.llr(elo0, elo1);
+                    decided = llr <= lower_bound || llr >= upper_bound;
+                }
+                if (decided || (done / 2) % report_every == 0) report();
+                if (decided) finished = true;
+            }
+        });
+    }
+    for (auto& worker : pool) worker.join();
+    
+    std::cout << "final: ";
+    report();
+    if (!sprt.empty()) {
+        double llr = stats.llr(elo0, elo1);
+        std::cout << "sprt [" << elo0 << ", " << elo1 << "]: "
+                  << (llr >= upper_bound ? "H1 accepted" : llr <= lower_bound ? "H0 accepted" : "inconclusive")
+                  << std::endl;
+    }
+    return 0;
+}
+
+// gensfen --out data.bin [--positions 1000000] [--nodes 5000 | --depth n]
+//         [--threads n] [--openings file.epd] [--random-plies 8]
+//         [--min-ply 16] [--seed n]
+// Self-play games at a fixed node or depth limit; every searched position
+// is written as a PackedPosition with the search score and the final game
+// result. Positions with the side to move in check, positions whose best
+// move is a capture or promotion, mate scores and the first --min-ply plies
+// of each game are skipped. Records are buffered per thread and appended to
+// the file in blocks, so an interrupted run leaves a usable file.
+int run_gensfen(const std::vector<std::string>& args) {
+    std::string out_path = arg_value(args, "--out", "");
+    if (out_path.empty()) {
+        std::cerr << "usage: gensfen --out data.bin [--positions 1000000] [--nodes 5000 | --depth n]"
+                     " [--threads n] [--openings file.epd] [--random-plies 8] [--min-ply 16]" << std::endl;
+        return 1;
+    }
+    long long target = std::stoll(arg_value(args, "--positions", "1000000"));
+    int depth = std::stoi(arg_value(args, "--depth", "0"));
+    long long nodes = std::stoll(arg_value(args, "--nodes", depth > 0 ? "0" : "5000"));
+    int threads = std::max(1, std::stoi(arg_value(args, "--threads", std::to_string(default_tool_threads()))));
+    int random_plies = std::stoi(arg_value(args, "--random-plies", "8"));
+    int min_ply = std::stoi(arg_value(args, "--min-ply", "16"));
+    unsigned long long seed = std::stoull(arg_value(args, "--seed", std::to_string(current_time_ms())));
+    std::string openings_path = arg_value(args, "--openings", "");
+    
+    std::vector<std::string> openings;
+    if (!openings_path.empty()) {
+        openings = load_openings(openings_path);
+        if (openings.empty()) {
+            std::cerr << "no positions in " << openings_path << std::endl;
+            return 1;
+        }
+    }
+    
+    FILE* out = fopen(out_path.c_str(), "ab");
+    if (!out) {
+        std::cerr << "cannot write " << out_path << std::endl;
+        return 1;
+    }
+    
+    PlayerConfig config;
+    config.params = search_params;
+    config.nodes = nodes;
+    config.depth = depth;
+    
+    const size_t FLUSH_RECORDS = 4096;
+    std::mutex out_mutex;
+    std::atomic<long long> written{0};
+    std::atomic<long long> reserved{0};  // records claimed by threads, capped at target
+    std::atomic<long long> games{0};
+    std::atomic<bool> write_failed{false};
+    long long start = current_time_ms();
+    long long next_report = 100000;
+    
+    auto flush = [&](std::vector<PackedPosition>& buffer) {
+        if (buffer.empty()) return;
+        std::lock_guard<std::mutex> lock(out_mutex);
+        if (fwrite(buffer.data(), sizeof(PackedPosition), buffer.size(), out) != buffer.size()) {
+            write_failed = true;
+        }
+        long long total = (written += (long long)buffer.size());
+        buffer.clear();
+        if (total >= next_report || total >= target) {
+            long long elapsed = std::max(1LL, current_time_ms() - start);
+            std::cout << "positions " << total << " games " << games
+                      << " pos/s " << total * 1000 / elapsed << std::endl;
+            while (next_report <= total) next_report += 100000;
+        }
+    };
+    
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.emplace_back([&, t]() {
+            std::mt19937_64 rng(seed + t * 0x9E3779B97F4A7C15ULL);
+            Adjudication adj;
+            SelfPlayer white(config), black(config);
+            std::vector<GamePly> plies;
+            std::vector<PackedPosition> buffer;
+            buffer.reserve(FLUSH_RECORDS);
+            
+            while (reserved < target && !write_failed) {
+                plies.clear();
+                Position opening = pick_opening(openings, rng, random_plies);
+                int result = play_game(white, black, opening, adj, &plies);
+                games++;
+                
+                size_t before = buffer.size();
+                for (size_t i = (size_t)std::max(0, min_ply); i < plies.size(); i++) {
+                    const GamePly& ply = plies[i];
+                    if (ply.move.is_capture() || ply.move.get_promo() != 0) continue;
+                    if (std::abs(ply.score) >= MATE_SCORE - MAX_PLY) continue;
+                    int us = ply.pos.side_to_move;
+                    if (is_square_attacked(ply.pos, lsb_index(ply.pos.pieces[us][K]), 1 - us)) continue;
+                    
+                    PackedPosition packed;
+                    int white_score = (us == WHITE) ? ply.score : -ply.score;
+                    if (pack_position(ply.pos, white_score, result, ply.halfmove_clock, packed)) {
+                        buffer.push_back(packed);
+                    }
+                }
+                
+                // Claim this game's records before buffering them, so the
+                // threads together stop exactly at the target
+                long long added = (long long)(buffer.size() - before);
+                long long claimed = reserved.fetch_add(added);
+                buffer.resize(before + (size_t)std::max(0LL, std::min(added, target - claimed)));
+                if (buffer.size() >= FLUSH_RECORDS) flush(buffer);
+            }
+            flush(buffer);
+        });
+    }
+    for (auto& worker : pool) worker.join();
+    fclose(out);
+    
+    if (write_failed) {
+        std::cerr << "write error on " << out_path << std::endl;
+        return 1;
+    }
+    std::cout << written << " positions from " << games << " games appended to " << out_path << std::endl;
+    return 0;
+}
+
+// ========================================
+// 16. Main Function
+// ========================================
+int main(int argc, char* argv[]) {
+    // Initialize all systems
+    init_zobrist_keys();
+    init_attack_tables();
+    init_kpk_bitbase();
+    init_eval_params();
+    init_psq_tables();
+    init_cuckoo_tables();
+    init_search_tables();
+    nnue_init("");  // embedded network if compiled in, else handcrafted eval
+    clear_tt(); // Initialize TT
+    load_search_params_env();
+    
+    // Tool subcommands: douchess <command> [arguments]
+    if (argc > 1) {
+        std::string command = argv[1];
+        std::vector<std::string> args(argv + 2, argv + argc);
+        if (command == "train") return run_train(args);
+        if (command == "tune") return run_tune(args);
+        if (command == "spsa") return run_spsa(args);
+        if (command == "match") return run_match(args);
+        if (command == "gensfen") return run_gensfen(args);
+        if (command == "convert") return run_convert(args);
+        if (command == "shuffle") return run_shuffle(args);
+        if (command == "pgn") return run_pgn(args);
+        std::cerr << "unknown command " << command << std::endl;
+        return 1;
+    }
     
     // Start UCI mode
     uci_loop();